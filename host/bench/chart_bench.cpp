@@ -0,0 +1,323 @@
+// Repeatable baseline for chart rendering and loading on the host.
+// Charts are generated from a fixed seed, so numbers and frame checksums are comparable between runs.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include "host/peripherals.h"
+#include "sd.h"
+#include "song_data.h"
+
+static std::uint64_t allocation_count{ 0 };
+
+void* operator new(std::size_t size)
+{
+    ++allocation_count;
+    if (void* pointer{ std::malloc(size ? size : 1) })
+    {
+        return pointer;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, [[maybe_unused]] std::size_t size) noexcept
+{
+    std::free(pointer);
+}
+
+namespace
+{
+using clock_type = std::chrono::steady_clock;
+using song_data::Note;
+using song_data::Song;
+
+struct ChartProfile
+{
+    const char* name;
+    std::uint32_t ms_per_pixel;
+    std::uint32_t mean_gap_ms; // Average time between note starts
+    std::uint32_t hold_percent; // Chance of a note being a hold
+    std::uint32_t max_hold_ms;
+    bool mixed_speeds;
+};
+
+constexpr ChartProfile profiles[]{
+    { "taps", 10, 150, 0, 0, false },
+    { "holds", 10, 150, 50, 2'000, false },
+    { "wide", 40, 150, 25, 1'000, false },
+    { "dense", 40, 20, 25, 4'000, false },
+    { "speeds", 10, 150, 25, 1'000, true },
+};
+
+constexpr std::uint32_t note_counts[]{ 100, 1'000, 10'000, 50'000, 200'000 };
+
+constexpr std::uint32_t frame_ms{ 5 }; // Roughly one pass through Machine::update during PlaySong
+constexpr std::uint32_t segment_count{ 8 }; // Frames are rendered in runs spread across the whole chart
+
+std::vector<Note> generate_notes(const ChartProfile& profile, std::uint32_t note_count)
+{
+    std::mt19937 random{ note_count * 31u + profile.ms_per_pixel };
+    std::uniform_int_distribution<std::uint32_t> gap{ 0, profile.mean_gap_ms * 2 };
+    std::uniform_int_distribution<std::uint32_t> percent{ 0, 99 };
+    std::uniform_int_distribution<std::uint32_t> hold{ 0, profile.max_hold_ms };
+    std::uniform_int_distribution<int> color{ Note::Color::Red, Note::Color::Blue };
+    constexpr float speeds[]{ 0.5f, 1.0f, 1.5f, 2.0f };
+    std::uniform_int_distribution<std::size_t> speed{ 0, std::size(speeds) - 1 };
+
+    std::vector<Note> notes;
+    notes.reserve(note_count);
+    std::uint32_t start_ms{ 1'000 };
+    for (std::uint32_t i{ 0 }; i < note_count; ++i)
+    {
+        start_ms += gap(random);
+        notes.push_back({
+            .note_color = static_cast<Note::Color>(color(random)),
+            .direction = percent(random) < 50 ? Note::Direction::Clockwise : Note::Direction::Counterclockwise,
+            .start_ms = start_ms,
+            .length_ms = percent(random) < profile.hold_percent ? hold(random) : 0,
+            .speed = profile.mixed_speeds ? speeds[speed(random)] : 1.0f,
+            .padding = {},
+        });
+    }
+    return notes;
+}
+
+template <typename T>
+void append_bytes(std::vector<std::uint8_t>& bytes, const T& value)
+{
+    const auto* first{ reinterpret_cast<const std::uint8_t*>(&value) };
+    bytes.insert(bytes.end(), first, first + sizeof(T));
+}
+
+void append_varint(std::vector<std::uint8_t>& bytes, std::uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        bytes.push_back(static_cast<std::uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back(static_cast<std::uint8_t>(value));
+}
+
+std::uint32_t crc32(std::span<const std::uint8_t> bytes)
+{
+    std::uint32_t crc{ ~0u };
+    for (const std::uint8_t byte : bytes)
+    {
+        crc ^= byte;
+        for (int bit{ 0 }; bit < 8; ++bit)
+        {
+            crc = (crc & 1) ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+// Mirrors tools/song_compiler.py
+std::vector<std::uint8_t> encode_chart(const ChartProfile& profile, std::span<const Note> notes, std::uint16_t version_major)
+{
+    Song::Header header{};
+    std::memcpy(header.magic_note, "NOTE", 4);
+    header.version_major = version_major;
+    header.ms_per_pixel = profile.ms_per_pixel;
+    header.note_count = static_cast<std::uint32_t>(notes.size());
+    std::strncpy(header.author.data(), "chart_bench", header.author.size());
+    header.difficulty = 5;
+
+    std::vector<std::uint8_t> body;
+    if (version_major == 1)
+    {
+        for (const Note& note : notes)
+        {
+            append_bytes(body, note);
+        }
+    }
+    else
+    {
+        std::vector<Song::BlockIndexEntry> index;
+        std::vector<std::uint8_t> note_data;
+        std::uint32_t previous_start_ms{ 0 };
+        for (std::uint32_t i{ 0 }; i < notes.size(); ++i)
+        {
+            const Note& note{ notes[i] };
+            while (index.size() * Song::BlockIndexEntry::block_ms <= note.start_ms)
+            {
+                index.push_back({ i, static_cast<std::uint32_t>(note_data.size()), previous_start_ms });
+            }
+            const bool has_speed{ note.speed != 1.0f };
+            note_data.push_back(static_cast<std::uint8_t>(
+                note.note_color | (note.direction << 2) | (note.length_ms != 0 ? 1 << 3 : 0) | (has_speed ? 1 << 4 : 0)
+            ));
+            append_varint(note_data, note.start_ms - previous_start_ms);
+            if (note.length_ms != 0)
+            {
+                append_varint(note_data, note.length_ms);
+            }
+            if (has_speed)
+            {
+                append_bytes(note_data, note.speed);
+            }
+            previous_start_ms = note.start_ms;
+        }
+        for (const Song::BlockIndexEntry& entry : index)
+        {
+            append_bytes(body, entry);
+        }
+        body.insert(body.end(), note_data.begin(), note_data.end());
+        header.block_count = static_cast<std::uint32_t>(index.size());
+        header.note_data_size = static_cast<std::uint32_t>(note_data.size());
+        header.checksum = crc32(body);
+    }
+    std::vector<std::uint8_t> file;
+    file.reserve(sizeof(header) + body.size());
+    append_bytes(file, header);
+    file.insert(file.end(), body.begin(), body.end());
+    return file;
+}
+
+struct LoadResult
+{
+    double ms_per_load;
+    double mb_per_second;
+    double sd_reads_per_load;
+    std::optional<Song> song;
+};
+
+LoadResult benchmark_load(const char* path, std::size_t file_size)
+{
+    const std::uint32_t repeats{ static_cast<std::uint32_t>(std::max<std::size_t>(3, 4'000'000 / file_size)) };
+    LoadResult result{};
+    Host::reset_counters();
+    const auto start{ clock_type::now() };
+    for (std::uint32_t i{ 0 }; i < repeats; ++i)
+    {
+        result.song = Song::load_from_note_file({ path });
+    }
+    const std::chrono::duration<double> elapsed{ clock_type::now() - start };
+    result.ms_per_load = elapsed.count() * 1'000.0 / repeats;
+    result.mb_per_second = static_cast<double>(file_size) * repeats / elapsed.count() / 1'000'000.0;
+    result.sd_reads_per_load = static_cast<double>(Host::counters().sd_read_calls) / repeats;
+    return result;
+}
+
+struct RenderResult
+{
+    double ns_per_frame;
+    double allocations_per_frame;
+    std::uint32_t checksum;
+};
+
+RenderResult benchmark_render(Song& song, std::uint32_t song_length_ms, std::uint32_t frame_count)
+{
+    const std::uint32_t frames_per_segment{ std::max(frame_count / segment_count, 1u) };
+    std::uint32_t checksum{ 2166136261u };
+    std::chrono::nanoseconds elapsed{ 0 };
+    std::uint64_t allocations{ 0 };
+    for (std::uint32_t segment{ 0 }; segment < segment_count; ++segment)
+    {
+        song.current_time_ms = song_length_ms / segment_count * segment;
+        const std::uint64_t allocations_before{ allocation_count };
+        const auto start{ clock_type::now() };
+        for (std::uint32_t frame{ 0 }; frame < frames_per_segment; ++frame)
+        {
+            const auto leds{ song.render_leds() };
+            for (const packed_color packed_pixel : leds)
+            {
+                const color pixel{ packed_pixel.unpack() };
+                checksum = (checksum ^ ((pixel.r << 16) | (pixel.g << 8) | pixel.b)) * 16777619u;
+            }
+            song.current_time_ms += frame_ms;
+        }
+        elapsed += clock_type::now() - start;
+        allocations += allocation_count - allocations_before;
+    }
+    const double total_frames{ static_cast<double>(frames_per_segment) * segment_count };
+    return {
+        static_cast<double>(elapsed.count()) / total_frames,
+        static_cast<double>(allocations) / total_frames,
+        checksum
+    };
+}
+
+void print_usage(const char* name)
+{
+    std::printf("Usage: %s [--frames N] [--max-notes N] [--format 1|2]\n", name);
+}
+}
+
+int main(int argc, char** argv)
+{
+    std::uint32_t frame_count{ 2'000 };
+    std::uint32_t max_notes{ ~0u };
+    std::uint16_t format{ Song::verison_major };
+    for (int i{ 1 }; i < argc; ++i)
+    {
+        const std::string argument{ argv[i] };
+        if (argument == "--frames" && i + 1 < argc)
+        {
+            frame_count = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (argument == "--max-notes" && i + 1 < argc)
+        {
+            max_notes = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (argument == "--format" && i + 1 < argc)
+        {
+            format = static_cast<std::uint16_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    SDCard sd;
+    if (!sd.init())
+    {
+        std::printf("Failed to mount the host SD card\n");
+        return 1;
+    }
+
+    std::printf("%-6s %8s %4s %12s %10s %10s %10s %10s %10s %10s\n",
+        "chart", "notes", "mspp", "ns/frame", "allocs/fr", "file KB", "load ms", "load MB/s", "sd reads", "checksum");
+    for (const ChartProfile& profile : profiles)
+    {
+        for (const std::uint32_t note_count : note_counts)
+        {
+            if (note_count > max_notes)
+            {
+                continue;
+            }
+            const std::vector<Note> notes{ generate_notes(profile, note_count) };
+            const std::vector<std::uint8_t> chart{ encode_chart(profile, notes, format) };
+            const std::string path{ "/bench_" + std::string{ profile.name } + "_" + std::to_string(note_count) + ".note" };
+            if (!sd.write_binary_file(path.c_str(), chart))
+            {
+                std::printf("Failed to write %s\n", path.c_str());
+                return 1;
+            }
+            LoadResult load{ benchmark_load(path.c_str(), chart.size()) };
+            if (!load.song.has_value())
+            {
+                std::printf("Failed to load %s\n", path.c_str());
+                return 1;
+            }
+            const RenderResult render{ benchmark_render(*load.song, notes.back().start_ms + notes.back().length_ms, frame_count) };
+            std::printf("%-6s %8u %4u %12.1f %10.2f %10.1f %10.3f %10.1f %10.1f %10.8x\n",
+                profile.name, note_count, profile.ms_per_pixel,
+                render.ns_per_frame, render.allocations_per_frame,
+                chart.size() / 1'024.0, load.ms_per_load, load.mb_per_second, load.sd_reads_per_load, render.checksum);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "pico/types.h"
+
+// Host stand-in for the pico SDK; see host/peripherals.h
+enum clock_index {
+    clk_gpout0 = 0,
+    clk_gpout1,
+    clk_gpout2,
+    clk_gpout3,
+    clk_ref,
+    clk_sys,
+    clk_peri,
+    clk_usb,
+    clk_adc,
+    clk_rtc,
+    CLK_COUNT
+};
+
+bool set_sys_clock_khz(std::uint32_t freq_khz, bool required);
+std::uint32_t clock_get_hz(enum clock_index clk_index);
@@ -0,0 +1,38 @@
+#pragma once
+#include "pico/types.h"
+
+// Host stand-in for the pico SDK; see host/peripherals.h
+// DMA into data_cmd is modelled as transactions on the bus, each ending at a word with the stop bit set.
+typedef struct {
+    volatile std::uint32_t enable;
+    volatile std::uint32_t tar;
+    volatile std::uint32_t data_cmd;
+} i2c_hw_t;
+
+typedef struct i2c_inst {
+    i2c_hw_t* hw;
+    uint index;
+    uint baudrate;
+} i2c_inst_t;
+
+extern i2c_inst_t i2c0_inst;
+extern i2c_inst_t i2c1_inst;
+#define i2c0 (&i2c0_inst)
+#define i2c1 (&i2c1_inst)
+#define i2c_default i2c0
+
+#define I2C_IC_DATA_CMD_STOP_BITS 0x00000200u
+
+static inline i2c_hw_t* i2c_get_hw(i2c_inst_t* i2c)
+{
+    return i2c->hw;
+}
+
+static inline uint i2c_get_dreq(i2c_inst_t* i2c, bool is_tx)
+{
+    return 32 + i2c->index * 2 + (is_tx ? 0 : 1);
+}
+
+uint i2c_init(i2c_inst_t* i2c, uint baudrate);
+int i2c_write_blocking(i2c_inst_t* i2c, std::uint8_t addr, const std::uint8_t* src, std::size_t len, bool nostop);
+int i2c_read_blocking(i2c_inst_t* i2c, std::uint8_t addr, std::uint8_t* dst, std::size_t len, bool nostop);
@@ -0,0 +1,28 @@
+#pragma once
+#include "pico/types.h"
+#include "hardware/gpio.h"
+
+// Host stand-in for the pico SDK; see host/peripherals.h
+typedef struct pio_hw {
+    uint index;
+    volatile std::uint32_t txf[4]; // Only used as DMA write addresses
+} pio_hw_t;
+typedef pio_hw_t* PIO;
+
+extern pio_hw_t pio0_hw;
+extern pio_hw_t pio1_hw;
+#define pio0 (&pio0_hw)
+#define pio1 (&pio1_hw)
+
+typedef struct pio_program {
+    const std::uint16_t* instructions;
+    std::uint8_t length;
+    std::int8_t origin;
+} pio_program_t;
+
+uint pio_add_program(PIO pio, const pio_program_t* program);
+void pio_gpio_init(PIO pio, uint pin);
+// Models the state machine shifting `bits_per_word` bits per FIFO entry at `bit_frequency`
+void pio_sm_host_configure(PIO pio, uint sm, float bit_frequency, uint bits_per_word);
+void pio_sm_put_blocking(PIO pio, uint sm, std::uint32_t data);
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
@@ -0,0 +1,19 @@
+#pragma once
+#include "pico/types.h"
+#include "hardware/irq.h"
+
+// Host stand-in for the pico SDK; see host/peripherals.h
+typedef struct {
+    std::uint32_t csr;
+    std::uint32_t div;
+    std::uint32_t top;
+} pwm_config;
+
+uint pwm_gpio_to_slice_num(uint gpio);
+void pwm_clear_irq(uint slice_num);
+void pwm_set_irq_enabled(uint slice_num, bool enabled);
+pwm_config pwm_get_default_config();
+void pwm_config_set_clkdiv(pwm_config* c, float div);
+void pwm_config_set_wrap(pwm_config* c, std::uint16_t wrap);
+void pwm_init(uint slice_num, pwm_config* c, bool start);
+void pwm_set_gpio_level(uint gpio, std::uint16_t level);
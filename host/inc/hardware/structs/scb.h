@@ -0,0 +1,9 @@
+#pragma once
+#include <cstdint>
+
+// Host stand-in for the pico SDK; see host/peripherals.h
+typedef struct {
+    std::uintptr_t vtor;
+} armv6m_scb_hw_t;
+
+extern armv6m_scb_hw_t* const scb_hw;
@@ -0,0 +1,8 @@
+#pragma once
+#include "pico/types.h"
+
+// Host stand-in for the pico SDK; see host/peripherals.h
+inline void __wfi() {}
+inline void __dmb() {}
+inline std::uint32_t save_and_disable_interrupts() { return 0; }
+inline void restore_interrupts([[maybe_unused]] std::uint32_t status) {}
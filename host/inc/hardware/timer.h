@@ -0,0 +1,15 @@
+#pragma once
+#include "pico/types.h"
+
+// Host stand-in for the pico SDK; see host/peripherals.h
+// An alarm's callback runs when virtual time reaches its target, as if it had interrupted whatever was running.
+#define NUM_TIMERS 4
+
+typedef void (*hardware_alarm_callback_t)(uint alarm_num);
+
+int hardware_alarm_claim_unused(bool required);
+void hardware_alarm_unclaim(uint alarm_num);
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback);
+// Returns true without arming the alarm if the target has already passed
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t target);
+void hardware_alarm_cancel(uint alarm_num);
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Controls for the host stand-in of the pico SDK.
+// Time is virtual: it only moves through sleeps, modelled bus transfers and advance_time_us,
+// so runs are deterministic and independent of the speed of the host.
+namespace Host
+{
+struct PeripheralCounters
+{
+    std::uint64_t sleep_calls{ 0 };
+    std::uint64_t slept_us{ 0 };
+    std::uint64_t pwm_level_writes{ 0 };
+    std::uint64_t pio_words{ 0 };
+    std::uint64_t pio_stall_us{ 0 }; // Time spent waiting on a full TX FIFO
+    std::uint64_t dma_transfers{ 0 };
+    std::uint64_t dma_words{ 0 };
+    std::uint64_t gpio_reads{ 0 };
+    std::uint64_t i2c_transactions{ 0 };
+    std::uint64_t i2c_bytes{ 0 }; // Payload only; the address byte is accounted for in i2c_bus_us
+    std::uint64_t i2c_bus_us{ 0 };
+    std::uint64_t sd_read_calls{ 0 };
+    std::uint64_t sd_sectors_read{ 0 };
+    std::uint64_t sd_write_calls{ 0 };
+    std::uint64_t sd_sectors_written{ 0 };
+};
+
+PeripheralCounters& counters();
+void reset_counters();
+
+std::uint64_t get_time_us();
+void advance_time_us(std::uint64_t us);
+
+// Buttons are pulled up, so an unset pin reads high (not pressed). Changing the level runs any GPIO edge callback.
+void set_gpio_input(std::uint32_t pin, bool level);
+
+// Runs the handler installed with irq_set_exclusive_handler if the IRQ is enabled
+bool fire_irq(std::uint32_t irq);
+
+// Recording is off by default so it does not show up in allocation counts
+void set_recording(bool enabled);
+const std::vector<std::uint32_t>& recorded_pio_words();
+const std::vector<std::uint8_t>& recorded_i2c_bytes();
+void clear_recording();
+
+// The SD card is a FAT formatted RAM disk which is created by the first sd_init
+bool sd_write_file(const char* path, std::span<const std::uint8_t> contents);
+bool sd_import_file(const char* host_path, const char* path);
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "ff.h"
+#include "sd_card.h"
+
+// Host stand-in for FatFs_SPI's hw_config.h; src/sd.cpp provides the definitions
+extern "C" {
+    size_t sd_get_num();
+    sd_card_t* sd_get_by_num(size_t num);
+
+    size_t spi_get_num();
+    spi_t* spi_get_by_num(size_t num);
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <cstdio>
+#include "pico/types.h"
+#include "pico/time.h"
+#include "hardware/gpio.h"
+
+// Host stand-in for the pico SDK; see host/peripherals.h
+bool stdio_init_all();
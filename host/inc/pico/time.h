@@ -0,0 +1,19 @@
+#pragma once
+#include "pico/types.h"
+
+// Host stand-in for the pico SDK; see host/peripherals.h
+std::uint64_t time_us_64();
+std::uint32_t time_us_32();
+void sleep_us(std::uint64_t us);
+void sleep_ms(std::uint32_t ms);
+void busy_wait_us(std::uint64_t us);
+
+static inline absolute_time_t get_absolute_time()
+{
+    return from_us_since_boot(time_us_64());
+}
+
+static inline absolute_time_t make_timeout_time_us(std::uint64_t us)
+{
+    return from_us_since_boot(time_us_64() + us);
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Host stand-in for the pico SDK; see host/peripherals.h
+typedef unsigned int uint;
+typedef std::uint64_t absolute_time_t;
+
+static inline std::uint64_t to_us_since_boot(absolute_time_t t)
+{
+    return t;
+}
+
+static inline absolute_time_t from_us_since_boot(std::uint64_t us)
+{
+    return us;
+}
+
+#ifndef count_of
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+enum pico_error_codes {
+    PICO_OK = 0,
+    PICO_ERROR_NONE = 0,
+    PICO_ERROR_TIMEOUT = -1,
+    PICO_ERROR_GENERIC = -2,
+    PICO_ERROR_NO_DATA = -3,
+};
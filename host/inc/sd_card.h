@@ -0,0 +1,40 @@
+#pragma once
+#include "pico/stdlib.h"
+#include "hardware/irq.h"
+#include "ff.h"
+#include "diskio.h"
+
+// Host stand-in for the FatFs_SPI SD card driver.
+// Only the fields src/sd.cpp fills in are kept; the card itself is a RAM disk (see host/peripherals.h).
+typedef struct spi_inst {
+    uint index;
+} spi_inst_t;
+
+extern spi_inst_t spi0_inst;
+#define spi0 (&spi0_inst)
+
+typedef struct {
+    spi_inst_t* hw_inst;
+    uint miso_gpio;
+    uint mosi_gpio;
+    uint sck_gpio;
+    uint baud_rate;
+    bool set_drive_strength;
+    enum gpio_drive_strength mosi_gpio_drive_strength;
+    enum gpio_drive_strength sck_gpio_drive_strength;
+    irq_handler_t dma_isr;
+} spi_t;
+
+typedef struct {
+    const char* pcName;
+    spi_t* spi;
+    uint ss_gpio;
+    bool set_drive_strength;
+    enum gpio_drive_strength ss_gpio_drive_strength;
+    int m_Status;
+} sd_card_t;
+
+bool sd_init_driver();
+bool sd_deinit_driver();
+int sd_init(sd_card_t* pSD);
+void spi_irq_handler(spi_t* pSPI);
@@ -0,0 +1,55 @@
+#pragma once
+#include "hardware/pio.h"
+
+// Host stand-in for the header pico_generate_pio_header builds from src/ws2812.pio.
+// The programs are never executed; initialising a state machine only configures its wire timing.
+
+#define ws2812_T1 2
+#define ws2812_T2 5
+#define ws2812_T3 3
+
+static const std::uint16_t ws2812_program_instructions[] = {
+    0x6221, //  0: out    x, 1            side 0 [2]
+    0x1123, //  1: jmp    !x, 3           side 1 [1]
+    0x1400, //  2: jmp    0               side 1 [4]
+    0xa442, //  3: nop                    side 0 [4]
+};
+
+static const pio_program_t ws2812_program = {
+    .instructions = ws2812_program_instructions,
+    .length = 4,
+    .origin = -1,
+};
+
+static inline void ws2812_program_init(PIO pio, uint sm, [[maybe_unused]] uint offset, uint pin, float freq, bool rgbw)
+{
+    pio_gpio_init(pio, pin);
+    pio_sm_host_configure(pio, sm, freq, rgbw ? 32 : 24);
+}
+
+#define ws2812_parallel_T1 2
+#define ws2812_parallel_T2 5
+#define ws2812_parallel_T3 3
+
+static const std::uint16_t ws2812_parallel_program_instructions[] = {
+    0x6020, //  0: out    x, 32
+    0xa10b, //  1: mov    pins, !null     [1]
+    0xa401, //  2: mov    pins, x         [4]
+    0xa103, //  3: mov    pins, null      [1]
+};
+
+static const pio_program_t ws2812_parallel_program = {
+    .instructions = ws2812_parallel_program_instructions,
+    .length = 4,
+    .origin = -1,
+};
+
+// Each 32-bit FIFO entry holds one bit-plane slice, i.e. one bit for each of up to 32 pins
+static inline void ws2812_parallel_program_init(PIO pio, uint sm, [[maybe_unused]] uint offset, uint pin_base, uint pin_count, float freq)
+{
+    for (uint i{ pin_base }; i < pin_base + pin_count; ++i)
+    {
+        pio_gpio_init(pio, i);
+    }
+    pio_sm_host_configure(pio, sm, freq, 1);
+}
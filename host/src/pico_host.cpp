@@ -0,0 +1,544 @@
+#include "host/peripherals.h"
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/i2c.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "hardware/pwm.h"
+#include "hardware/structs/scb.h"
+#include "hardware/timer.h"
+
+static i2c_hw_t i2c0_hw{};
+static i2c_hw_t i2c1_hw{};
+i2c_inst_t i2c0_inst{ &i2c0_hw, 0, 0 };
+i2c_inst_t i2c1_inst{ &i2c1_hw, 1, 0 };
+pio_hw_t pio0_hw{ 0, {} };
+pio_hw_t pio1_hw{ 1, {} };
+
+static std::array<irq_handler_t, NUM_IRQS> vector_table{};
+static armv6m_scb_hw_t scb{ reinterpret_cast<std::uintptr_t>(vector_table.data()) };
+armv6m_scb_hw_t* const scb_hw{ &scb };
+
+extern "C" void __unhandled_user_irq(void) {}
+
+namespace
+{
+constexpr std::size_t gpio_count{ NUM_BANK0_GPIOS };
+constexpr std::size_t pio_sm_count{ 4 };
+constexpr std::uint32_t pio_fifo_depth{ 8 }; // TX and RX FIFOs are joined by ws2812_program_init
+
+struct PIOStateMachine
+{
+    std::uint64_t word_time_ns{ 0 };
+    std::uint64_t drained_at_ns{ 0 }; // When the last queued word will have left the shift register
+};
+
+struct DMAChannel
+{
+    bool claimed{ false };
+    dma_channel_config config{};
+    volatile void* write_addr{ nullptr };
+    std::uint64_t busy_until_ns{ 0 };
+};
+
+struct Alarm
+{
+    bool claimed{ false };
+    bool armed{ false };
+    std::uint64_t target_ns{ 0 };
+    hardware_alarm_callback_t callback{ nullptr };
+};
+
+struct HostState
+{
+    Host::PeripheralCounters counters;
+    std::uint64_t now_ns{ 0 };
+    std::uint32_t sys_clock_hz{ 125'000'000 };
+    std::bitset<gpio_count> gpio_low;
+    std::array<std::uint32_t, gpio_count> gpio_irq_events{};
+    gpio_irq_callback_t gpio_callback{ nullptr };
+    std::bitset<NUM_IRQS> irq_enabled;
+    std::array<std::array<PIOStateMachine, pio_sm_count>, 2> pio_sms;
+    std::array<DMAChannel, NUM_DMA_CHANNELS> dma_channels;
+    std::array<Alarm, NUM_TIMERS> alarms;
+    bool in_alarm{ false };
+    std::array<std::uint64_t, 2> i2c_free_at_ns{}; // When the last queued transaction leaves the bus
+    bool recording{ false };
+    std::vector<std::uint32_t> pio_words;
+    std::vector<std::uint8_t> i2c_bytes;
+};
+
+HostState& state()
+{
+    static HostState host_state;
+    return host_state;
+}
+
+// Alarms which come due run at their target time, unless one is already running
+void advance_ns(std::uint64_t ns)
+{
+    HostState& host{ state() };
+    const std::uint64_t until_ns{ host.now_ns + ns };
+    while (!host.in_alarm)
+    {
+        Alarm* next{ nullptr };
+        for (Alarm& alarm : host.alarms)
+        {
+            if (alarm.armed && alarm.target_ns <= until_ns && (next == nullptr || alarm.target_ns < next->target_ns))
+            {
+                next = &alarm;
+            }
+        }
+        if (next == nullptr)
+        {
+            break;
+        }
+        host.now_ns = std::max(host.now_ns, next->target_ns);
+        next->armed = false;
+        host.in_alarm = true;
+        next->callback(static_cast<uint>(next - host.alarms.data()));
+        host.in_alarm = false;
+    }
+    host.now_ns = std::max(host.now_ns, until_ns);
+}
+
+// Start + address + payload, 9 clocks per byte including the ACK
+std::uint64_t get_i2c_transaction_ns(const i2c_inst_t* i2c, std::size_t len)
+{
+    return (1 + (len + 1) * 9) * 1'000'000'000ull / std::max(i2c->baudrate, 1u);
+}
+
+i2c_inst_t* get_i2c_instance(volatile void* data_cmd)
+{
+    for (i2c_inst_t* i2c : { i2c0, i2c1 })
+    {
+        if (data_cmd == &i2c->hw->data_cmd)
+        {
+            return i2c;
+        }
+    }
+    return nullptr;
+}
+
+void record_i2c_bytes(const std::uint8_t* bytes, std::size_t len)
+{
+    HostState& host{ state() };
+    ++host.counters.i2c_transactions;
+    host.counters.i2c_bytes += len;
+    if (host.recording)
+    {
+        host.i2c_bytes.insert(host.i2c_bytes.end(), bytes, bytes + len);
+    }
+}
+
+// Queues a word behind the ones already on the wire, returning when it will have entered the FIFO
+std::uint64_t queue_pio_word(PIOStateMachine& state_machine, std::uint32_t data)
+{
+    HostState& host{ state() };
+    const std::uint64_t fifo_ns{ state_machine.word_time_ns * pio_fifo_depth };
+    const std::uint64_t entered_fifo_ns{ std::max(host.now_ns, state_machine.drained_at_ns > fifo_ns ? state_machine.drained_at_ns - fifo_ns : 0) };
+    state_machine.drained_at_ns = std::max(state_machine.drained_at_ns, host.now_ns) + state_machine.word_time_ns;
+    ++host.counters.pio_words;
+    if (host.recording)
+    {
+        host.pio_words.push_back(data);
+    }
+    return entered_fifo_ns;
+}
+
+PIOStateMachine* get_pio_state_machine(volatile void* tx_fifo)
+{
+    for (pio_hw_t* pio : { pio0, pio1 })
+    {
+        for (uint sm{ 0 }; sm < pio_sm_count; ++sm)
+        {
+            if (tx_fifo == &pio->txf[sm])
+            {
+                return &state().pio_sms[pio->index][sm];
+            }
+        }
+    }
+    return nullptr;
+}
+}
+
+namespace Host
+{
+PeripheralCounters& counters()
+{
+    return state().counters;
+}
+
+void reset_counters()
+{
+    state().counters = {};
+}
+
+std::uint64_t get_time_us()
+{
+    return state().now_ns / 1000;
+}
+
+void advance_time_us(std::uint64_t us)
+{
+    advance_ns(us * 1000);
+}
+
+void set_gpio_input(std::uint32_t pin, bool level)
+{
+    HostState& host{ state() };
+    if (host.gpio_low[pin] != level)
+    {
+        return;
+    }
+    host.gpio_low[pin] = !level;
+    const std::uint32_t event{ level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL };
+    if ((host.gpio_irq_events[pin] & event) && host.irq_enabled[IO_IRQ_BANK0] && host.gpio_callback != nullptr)
+    {
+        host.gpio_callback(pin, event);
+    }
+}
+
+bool fire_irq(std::uint32_t irq)
+{
+    if (irq >= NUM_IRQS || !state().irq_enabled[irq] || vector_table[irq] == nullptr)
+    {
+        return false;
+    }
+    vector_table[irq]();
+    return true;
+}
+
+void set_recording(bool enabled)
+{
+    state().recording = enabled;
+}
+
+const std::vector<std::uint32_t>& recorded_pio_words()
+{
+    return state().pio_words;
+}
+
+const std::vector<std::uint8_t>& recorded_i2c_bytes()
+{
+    return state().i2c_bytes;
+}
+
+void clear_recording()
+{
+    state().pio_words.clear();
+    state().i2c_bytes.clear();
+}
+}
+
+// pico_stdlib
+
+bool stdio_init_all()
+{
+    return true;
+}
+
+std::uint64_t time_us_64()
+{
+    return Host::get_time_us();
+}
+
+std::uint32_t time_us_32()
+{
+    return static_cast<std::uint32_t>(Host::get_time_us());
+}
+
+void sleep_us(std::uint64_t us)
+{
+    ++state().counters.sleep_calls;
+    state().counters.slept_us += us;
+    Host::advance_time_us(us);
+}
+
+void sleep_ms(std::uint32_t ms)
+{
+    sleep_us(static_cast<std::uint64_t>(ms) * 1000);
+}
+
+void busy_wait_us(std::uint64_t us)
+{
+    sleep_us(us);
+}
+
+bool set_sys_clock_khz(std::uint32_t freq_khz, [[maybe_unused]] bool required)
+{
+    state().sys_clock_hz = freq_khz * 1000;
+    return true;
+}
+
+std::uint32_t clock_get_hz([[maybe_unused]] enum clock_index clk_index)
+{
+    return state().sys_clock_hz;
+}
+
+// hardware_gpio
+
+void gpio_init([[maybe_unused]] uint gpio) {}
+void gpio_set_function([[maybe_unused]] uint gpio, [[maybe_unused]] enum gpio_function fn) {}
+void gpio_set_dir([[maybe_unused]] uint gpio, [[maybe_unused]] bool out) {}
+void gpio_set_pulls([[maybe_unused]] uint gpio, [[maybe_unused]] bool up, [[maybe_unused]] bool down) {}
+void gpio_pull_up([[maybe_unused]] uint gpio) {}
+
+bool gpio_get(uint gpio)
+{
+    ++state().counters.gpio_reads;
+    return !state().gpio_low[gpio];
+}
+
+void gpio_set_irq_enabled(uint gpio, std::uint32_t event_mask, bool enabled)
+{
+    std::uint32_t& events{ state().gpio_irq_events[gpio] };
+    events = enabled ? events | event_mask : events & ~event_mask;
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, std::uint32_t event_mask, bool enabled, gpio_irq_callback_t callback)
+{
+    gpio_set_irq_enabled(gpio, event_mask, enabled);
+    state().gpio_callback = callback;
+    irq_set_enabled(IO_IRQ_BANK0, true);
+}
+
+// hardware_irq
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler)
+{
+    vector_table[num] = handler;
+}
+
+void irq_set_enabled(uint num, bool enabled)
+{
+    state().irq_enabled[num] = enabled;
+}
+
+bool irq_is_enabled(uint num)
+{
+    return state().irq_enabled[num];
+}
+
+// hardware_pwm
+
+uint pwm_gpio_to_slice_num(uint gpio)
+{
+    return (gpio >> 1u) & 7u;
+}
+
+void pwm_clear_irq([[maybe_unused]] uint slice_num) {}
+void pwm_set_irq_enabled([[maybe_unused]] uint slice_num, [[maybe_unused]] bool enabled) {}
+
+pwm_config pwm_get_default_config()
+{
+    return { 0, 1 << 4, 0xffff };
+}
+
+void pwm_config_set_clkdiv(pwm_config* c, float div)
+{
+    c->div = static_cast<std::uint32_t>(div * (1 << 4));
+}
+
+void pwm_config_set_wrap(pwm_config* c, std::uint16_t wrap)
+{
+    c->top = wrap;
+}
+
+void pwm_init([[maybe_unused]] uint slice_num, [[maybe_unused]] pwm_config* c, [[maybe_unused]] bool start) {}
+
+void pwm_set_gpio_level([[maybe_unused]] uint gpio, [[maybe_unused]] std::uint16_t level)
+{
+    ++state().counters.pwm_level_writes;
+}
+
+// hardware_i2c
+
+uint i2c_init(i2c_inst_t* i2c, uint baudrate)
+{
+    i2c->baudrate = baudrate;
+    return baudrate;
+}
+
+int i2c_write_blocking(i2c_inst_t* i2c, [[maybe_unused]] std::uint8_t addr, const std::uint8_t* src, std::size_t len, [[maybe_unused]] bool nostop)
+{
+    HostState& host{ state() };
+    record_i2c_bytes(src, len);
+    const std::uint64_t bus_ns{ get_i2c_transaction_ns(i2c, len) };
+    host.counters.i2c_bus_us += bus_ns / 1000;
+    const std::uint64_t start_ns{ std::max(host.now_ns, host.i2c_free_at_ns[i2c->index]) };
+    host.i2c_free_at_ns[i2c->index] = start_ns + bus_ns;
+    advance_ns(start_ns + bus_ns - host.now_ns);
+    return static_cast<int>(len);
+}
+
+int i2c_read_blocking([[maybe_unused]] i2c_inst_t* i2c, [[maybe_unused]] std::uint8_t addr, [[maybe_unused]] std::uint8_t* dst, [[maybe_unused]] std::size_t len, [[maybe_unused]] bool nostop)
+{
+    return PICO_ERROR_GENERIC;
+}
+
+// hardware_pio
+
+uint pio_add_program([[maybe_unused]] PIO pio, [[maybe_unused]] const pio_program_t* program)
+{
+    return 0;
+}
+
+void pio_gpio_init([[maybe_unused]] PIO pio, [[maybe_unused]] uint pin) {}
+
+void pio_sm_host_configure(PIO pio, uint sm, float bit_frequency, uint bits_per_word)
+{
+    PIOStateMachine& state_machine{ state().pio_sms[pio->index][sm] };
+    state_machine.word_time_ns = static_cast<std::uint64_t>(1'000'000'000.0f * bits_per_word / bit_frequency);
+    state_machine.drained_at_ns = state().now_ns;
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, std::uint32_t data)
+{
+    HostState& host{ state() };
+    PIOStateMachine& state_machine{ host.pio_sms[pio->index][sm] };
+    // A put only blocks while the FIFO is full, i.e. while more than pio_fifo_depth words are still queued
+    const std::uint64_t entered_fifo_ns{ queue_pio_word(state_machine, data) };
+    if (entered_fifo_ns > host.now_ns)
+    {
+        host.counters.pio_stall_us += (entered_fifo_ns - host.now_ns) / 1000;
+        advance_ns(entered_fifo_ns - host.now_ns);
+    }
+}
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx)
+{
+    return pio->index * 8 + (is_tx ? 0 : 4) + sm;
+}
+
+// hardware_dma
+
+int dma_claim_unused_channel(bool required)
+{
+    for (std::size_t channel{ 0 }; channel < NUM_DMA_CHANNELS; ++channel)
+    {
+        if (!state().dma_channels[channel].claimed)
+        {
+            state().dma_channels[channel].claimed = true;
+            return static_cast<int>(channel);
+        }
+    }
+    return required ? PICO_ERROR_GENERIC : -1;
+}
+
+void dma_channel_unclaim(uint channel)
+{
+    state().dma_channels[channel] = {};
+}
+
+dma_channel_config dma_channel_get_default_config([[maybe_unused]] uint channel)
+{
+    return { DMA_SIZE_32, true, false, 0x3f };
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* write_addr, const volatile void* read_addr, uint transfer_count, bool trigger)
+{
+    DMAChannel& dma_channel{ state().dma_channels[channel] };
+    dma_channel.config = *config;
+    dma_channel.write_addr = write_addr;
+    if (trigger)
+    {
+        dma_channel_transfer_from_buffer_now(channel, read_addr, transfer_count);
+    }
+}
+
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void* read_addr, uint32_t transfer_count)
+{
+    HostState& host{ state() };
+    DMAChannel& dma_channel{ host.dma_channels[channel] };
+    ++host.counters.dma_transfers;
+    host.counters.dma_words += transfer_count;
+    dma_channel.busy_until_ns = host.now_ns;
+    const volatile std::uint32_t* words{ static_cast<const volatile std::uint32_t*>(read_addr) };
+    const auto get_word{ [&](std::uint32_t i) { return words[dma_channel.config.read_increment ? i : 0]; } };
+    // Words into an I2C TX FIFO become transactions queued on the bus, which the DMA doesn't wait for
+    if (i2c_inst_t* i2c{ get_i2c_instance(dma_channel.write_addr) }; i2c != nullptr && dma_channel.config.transfer_size == DMA_SIZE_32)
+    {
+        std::vector<std::uint8_t> transaction;
+        for (std::uint32_t i{ 0 }; i < transfer_count; ++i)
+        {
+            transaction.push_back(static_cast<std::uint8_t>(get_word(i)));
+            if (get_word(i) & I2C_IC_DATA_CMD_STOP_BITS)
+            {
+                record_i2c_bytes(transaction.data(), transaction.size());
+                const std::uint64_t bus_ns{ get_i2c_transaction_ns(i2c, transaction.size()) };
+                host.counters.i2c_bus_us += bus_ns / 1000;
+                host.i2c_free_at_ns[i2c->index] = std::max(host.now_ns, host.i2c_free_at_ns[i2c->index]) + bus_ns;
+                transaction.clear();
+            }
+        }
+        return;
+    }
+    // Otherwise only transfers of words into a PIO TX FIFO are modelled
+    PIOStateMachine* state_machine{ get_pio_state_machine(dma_channel.write_addr) };
+    if (state_machine == nullptr || dma_channel.config.transfer_size != DMA_SIZE_32)
+    {
+        return;
+    }
+    for (std::uint32_t i{ 0 }; i < transfer_count; ++i)
+    {
+        dma_channel.busy_until_ns = queue_pio_word(*state_machine, get_word(i));
+    }
+}
+
+bool dma_channel_is_busy(uint channel)
+{
+    return state().dma_channels[channel].busy_until_ns > state().now_ns;
+}
+
+void dma_channel_wait_for_finish_blocking(uint channel)
+{
+    const std::uint64_t busy_until_ns{ state().dma_channels[channel].busy_until_ns };
+    if (busy_until_ns > state().now_ns)
+    {
+        advance_ns(busy_until_ns - state().now_ns);
+    }
+}
+
+// hardware_timer
+
+int hardware_alarm_claim_unused(bool required)
+{
+    for (std::size_t alarm{ 0 }; alarm < NUM_TIMERS; ++alarm)
+    {
+        if (!state().alarms[alarm].claimed)
+        {
+            state().alarms[alarm].claimed = true;
+            return static_cast<int>(alarm);
+        }
+    }
+    return required ? PICO_ERROR_GENERIC : -1;
+}
+
+void hardware_alarm_unclaim(uint alarm_num)
+{
+    state().alarms[alarm_num] = {};
+}
+
+void hardware_alarm_set_callback(uint alarm_num, hardware_alarm_callback_t callback)
+{
+    state().alarms[alarm_num].callback = callback;
+}
+
+bool hardware_alarm_set_target(uint alarm_num, absolute_time_t target)
+{
+    HostState& host{ state() };
+    Alarm& alarm{ host.alarms[alarm_num] };
+    alarm.target_ns = to_us_since_boot(target) * 1000;
+    alarm.armed = alarm.target_ns > host.now_ns;
+    return !alarm.armed;
+}
+
+void hardware_alarm_cancel(uint alarm_num)
+{
+    state().alarms[alarm_num].armed = false;
+}
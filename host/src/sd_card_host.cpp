@@ -0,0 +1,175 @@
+#include "host/peripherals.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include "sd_card.h"
+#include "ff.h"
+#include "diskio.h"
+
+spi_inst_t spi0_inst{ 0 };
+
+namespace
+{
+constexpr std::size_t sector_size{ FF_MAX_SS };
+constexpr std::size_t sector_count{ 64 * 1024 }; // 32MiB
+
+std::vector<std::uint8_t>& ram_disk()
+{
+    static std::vector<std::uint8_t> sectors;
+    return sectors;
+}
+
+bool format_ram_disk()
+{
+    if (!ram_disk().empty())
+    {
+        return true;
+    }
+    ram_disk().resize(sector_size * sector_count);
+    std::vector<BYTE> work(FF_MAX_SS * 4);
+    const MKFS_PARM options{ .fmt = FM_ANY | FM_SFD };
+    if (f_mkfs("0:", &options, work.data(), static_cast<UINT>(work.size())) != FR_OK)
+    {
+        ram_disk().clear();
+        return false;
+    }
+    return true;
+}
+
+// Lets the Host helpers write files before (or without) an SDCard mounting the volume
+bool mount_for_host()
+{
+    static FATFS host_file_system;
+    if (!format_ram_disk())
+    {
+        return false;
+    }
+    DIR root;
+    const FRESULT open_result{ f_opendir(&root, "/") };
+    if (open_result == FR_OK)
+    {
+        f_closedir(&root);
+        return true;
+    }
+    return open_result == FR_NOT_ENABLED && f_mount(&host_file_system, "0:", 1) == FR_OK;
+}
+}
+
+namespace Host
+{
+bool sd_write_file(const char* path, std::span<const std::uint8_t> contents)
+{
+    if (!mount_for_host())
+    {
+        return false;
+    }
+    // Make every parent directory along the way
+    std::string directory{ path };
+    for (std::size_t separator{ directory.find('/', 1) }; separator != std::string::npos; separator = directory.find('/', separator + 1))
+    {
+        f_mkdir(directory.substr(0, separator).c_str());
+    }
+    FIL file;
+    if (f_open(&file, path, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+    {
+        return false;
+    }
+    UINT written{ 0 };
+    const FRESULT write_result{ f_write(&file, contents.data(), static_cast<UINT>(contents.size()), &written) };
+    const FRESULT close_result{ f_close(&file) };
+    return write_result == FR_OK && close_result == FR_OK && written == contents.size();
+}
+
+bool sd_import_file(const char* host_path, const char* path)
+{
+    std::ifstream stream{ host_path, std::ios::binary };
+    if (!stream)
+    {
+        return false;
+    }
+    const std::vector<std::uint8_t> contents{ std::istreambuf_iterator<char>{ stream }, std::istreambuf_iterator<char>{} };
+    return sd_write_file(path, contents);
+}
+}
+
+// FatFs_SPI driver
+
+bool sd_init_driver()
+{
+    return true;
+}
+
+bool sd_deinit_driver()
+{
+    return true;
+}
+
+int sd_init(sd_card_t* pSD)
+{
+    pSD->m_Status = format_ram_disk() ? 0 : STA_NOINIT;
+    return pSD->m_Status;
+}
+
+void spi_irq_handler([[maybe_unused]] spi_t* pSPI) {}
+
+// FatFs disk I/O
+
+extern "C" {
+DSTATUS disk_status([[maybe_unused]] BYTE pdrv)
+{
+    return ram_disk().empty() ? STA_NOINIT : 0;
+}
+
+DSTATUS disk_initialize([[maybe_unused]] BYTE pdrv)
+{
+    return 0;
+}
+
+DRESULT disk_read([[maybe_unused]] BYTE pdrv, BYTE* buff, LBA_t sector, UINT count)
+{
+    if (sector + count > sector_count)
+    {
+        return RES_PARERR;
+    }
+    Host::PeripheralCounters& counters{ Host::counters() };
+    ++counters.sd_read_calls;
+    counters.sd_sectors_read += count;
+    std::memcpy(buff, ram_disk().data() + sector * sector_size, count * sector_size);
+    return RES_OK;
+}
+
+DRESULT disk_write([[maybe_unused]] BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count)
+{
+    if (sector + count > sector_count)
+    {
+        return RES_PARERR;
+    }
+    Host::PeripheralCounters& counters{ Host::counters() };
+    ++counters.sd_write_calls;
+    counters.sd_sectors_written += count;
+    std::memcpy(ram_disk().data() + sector * sector_size, buff, count * sector_size);
+    return RES_OK;
+}
+
+DRESULT disk_ioctl([[maybe_unused]] BYTE pdrv, BYTE cmd, void* buff)
+{
+    switch (cmd)
+    {
+    case CTRL_SYNC:
+        return RES_OK;
+    case GET_SECTOR_COUNT:
+        *static_cast<LBA_t*>(buff) = sector_count;
+        return RES_OK;
+    case GET_BLOCK_SIZE:
+        *static_cast<DWORD*>(buff) = 1;
+        return RES_OK;
+    }
+    return RES_PARERR;
+}
+
+DWORD get_fattime(void)
+{
+    // 2023-01-01 00:00:00
+    return (static_cast<DWORD>(2023 - 1980) << 25) | (1u << 21) | (1u << 16);
+}
+}
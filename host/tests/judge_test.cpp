@@ -0,0 +1,168 @@
+// Plays a chart through the judge with presses early, late and missing, checking every note is graded once, whether
+// the chart is loaded whole or streamed from the SD card. Then judges presses and releases in different lanes out of
+// the order they happened, as they come from the buttons within one update.
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "host/peripherals.h"
+#include "judge.h"
+#include "sd.h"
+#include "song_data.h"
+
+namespace
+{
+using song_data::Judge;
+using song_data::Note;
+using song_data::Song;
+
+int failures{ 0 };
+
+void check(bool condition, const std::string& what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what.c_str());
+        ++failures;
+    }
+}
+
+constexpr std::uint32_t note_count{ 6'000 };
+constexpr std::uint32_t hold_count{ note_count / 5 };
+// Streams the chart, since it has more notes than this
+constexpr std::uint32_t streamed_max_notes{ 4'096 };
+
+// Notes 50ms apart, cycling through the lanes, so each lane has a note every 300ms; every fifth is a 200ms hold
+std::vector<Note> generate_notes()
+{
+    std::vector<Note> notes;
+    for (std::uint32_t i{ 0 }; i < note_count; ++i)
+    {
+        notes.push_back({
+            .note_color = static_cast<Note::Color>(i % 3),
+            .direction = static_cast<Note::Direction>(i / 3 % 2),
+            .start_ms = 1'000 + i * 50,
+            .length_ms = i % 5 == 0 ? 200u : 0u,
+            .speed = 1.0f,
+            .padding = {},
+        });
+    }
+    return notes;
+}
+
+bool write_chart(SDCard& sd, const char* path, const std::vector<Note>& notes)
+{
+    Song::Header header{};
+    std::memcpy(header.magic_note, "NOTE", 4);
+    header.version_major = 1;
+    header.ms_per_pixel = 10;
+    header.note_count = static_cast<std::uint32_t>(notes.size());
+    header.difficulty = 5;
+    std::vector<std::uint8_t> bytes(sizeof(header) + notes.size() * sizeof(Note));
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    std::memcpy(bytes.data() + sizeof(header), notes.data(), notes.size() * sizeof(Note));
+    return sd.write_binary_file(path, bytes);
+}
+
+// Runs through the song a ms at a time as PlaySong would, pressing each note press_offset_us from its start
+Judge::Stats play(Song& song, const std::vector<Note>& notes, bool press, std::int64_t press_offset_us)
+{
+    Judge judge{ song.header.difficulty };
+    std::size_t next_press{ 0 };
+    const std::uint32_t end_ms{ notes.back().start_ms + notes.back().length_ms + 1'000 };
+    for (std::uint32_t time_ms{ 0 }; time_ms < end_ms; ++time_ms)
+    {
+        const std::int64_t time_us{ std::int64_t{ time_ms } * 1'000 };
+        song.current_time_ms = time_ms;
+        song.refill_note_stream(judge.get_first_unjudged_note());
+        while (press && next_press < notes.size() && std::int64_t{ notes[next_press].start_ms } * 1'000 + press_offset_us <= time_us)
+        {
+            const Note& note{ notes[next_press] };
+            judge.press(song, Judge::get_lane(note.note_color, note.direction), std::int64_t{ note.start_ms } * 1'000 + press_offset_us);
+            ++next_press;
+        }
+        judge.update(song, time_us);
+    }
+    return judge.get_stats();
+}
+
+// Presses the first notes of lanes 0, 1, 4 and 5, judged in lane order rather than time order. Lane 0 and lane 5
+// start with 200ms holds; lane 0's is let go 150ms early, after later events in other lanes were judged.
+Judge::Stats judge_out_of_order(const Song& song, const std::vector<Note>& notes)
+{
+    const auto start_us{ [&notes](std::size_t index) { return std::int64_t{ notes[index].start_ms } * 1'000; } };
+    const auto lane{ [&notes](std::size_t index) { return Judge::get_lane(notes[index].note_color, notes[index].direction); } };
+    Judge judge{ song.header.difficulty };
+    judge.press(song, lane(0), start_us(0)); // Perfect
+    judge.press(song, lane(4), start_us(4)); // Perfect, stamped 150ms after the next
+    judge.press(song, lane(1), start_us(1) + 100'000); // Good, though lane 4's press was past its window
+    judge.press(song, lane(5), start_us(5)); // Perfect, stamped after lane 0's hold ends
+    judge.release(song, lane(0), start_us(0) + 50'000); // Miss, let go 150ms before the end
+    judge.release(song, lane(5), start_us(5) + 190'000); // Perfect, 10ms before the end
+    return judge.get_stats();
+}
+
+void check_grades(const Judge::Stats& stats, std::uint32_t perfect, std::uint32_t good, std::uint32_t miss, const std::string& what)
+{
+    const auto& grades{ stats.grades };
+    check(grades[static_cast<std::size_t>(Judge::Grade::Perfect)] == perfect
+        && grades[static_cast<std::size_t>(Judge::Grade::Good)] == good
+        && grades[static_cast<std::size_t>(Judge::Grade::Miss)] == miss,
+        what + ": got " + std::to_string(grades[0]) + " Perfect, " + std::to_string(grades[1]) + " Good, "
+            + std::to_string(grades[2]) + " Miss");
+}
+}
+
+int main()
+{
+    SDCard sd;
+    if (!sd.init())
+    {
+        std::printf("Failed to mount the host SD card\n");
+        return 1;
+    }
+    const std::vector<Note> notes{ generate_notes() };
+    const char* path{ "/judge_test.note" };
+    if (!write_chart(sd, path, notes))
+    {
+        std::printf("Failed to write %s\n", path);
+        return 1;
+    }
+
+    for (const bool streamed : { false, true })
+    {
+        const std::string chart{ streamed ? "Streamed" : "Loaded" };
+        const auto load{ [&] {
+            return Song::load_from_note_file({ path }, streamed ? streamed_max_notes : ~0u);
+        } };
+        std::optional<Song> song{ load() };
+        check(song.has_value() && song->is_streamed() == streamed, chart + " chart loads");
+        if (!song.has_value())
+        {
+            continue;
+        }
+        // Holds are only let go after their end, which finishes them as Perfect
+        check_grades(play(*song, notes, true, 0), note_count + hold_count, 0, 0, chart + " presses on time");
+        song = load();
+        check_grades(play(*song, notes, true, 60'000), hold_count, note_count, 0, chart + " presses 60ms late");
+        song = load();
+        check_grades(play(*song, notes, true, -60'000), hold_count, note_count, 0, chart + " presses 60ms early");
+        song = load();
+        check_grades(play(*song, notes, true, 130'000), 0, 0, note_count, chart + " presses 130ms late");
+        song = load();
+        check_grades(play(*song, notes, false, 0), 0, 0, note_count, chart + " without presses");
+    }
+
+    if (const std::optional<Song> song{ Song::load_from_note_file({ path }) })
+    {
+        check_grades(judge_out_of_order(*song, notes), 4, 1, 1, "Events judged out of order");
+    }
+
+    if (failures != 0)
+    {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,174 @@
+// Checks that the LCD's queue sends bytes in the order they were posted, with the HD44780's execution times between
+// them, without the caller ever waiting on the bus.
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "host/peripherals.h"
+#include "lcd.h"
+
+namespace
+{
+int failures{ 0 };
+
+void check(bool condition, const char* what)
+{
+    if (!condition)
+    {
+        std::printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+struct LCDByte
+{
+    std::uint8_t value;
+    bool is_character;
+    std::uint64_t sent_at_us;
+};
+
+// Each byte goes out as one 4-byte transaction: high nibble with enable, high, low with enable, low
+struct LCDModel
+{
+    std::vector<LCDByte> bytes;
+    std::size_t decoded_i2c_bytes{ 0 };
+    std::string ddram = std::string(0x80, ' ');
+    std::uint8_t address{ 0 };
+    std::uint32_t clears{ 0 };
+
+    void decode(std::uint64_t now_us)
+    {
+        const std::vector<std::uint8_t>& i2c_bytes{ Host::recorded_i2c_bytes() };
+        for (; decoded_i2c_bytes + 4 <= i2c_bytes.size(); decoded_i2c_bytes += 4)
+        {
+            const std::uint8_t* sequence{ &i2c_bytes[decoded_i2c_bytes] };
+            const LCDByte byte{
+                static_cast<std::uint8_t>((sequence[0] & 0xf0) | (sequence[2] >> 4)), (sequence[0] & 1) != 0, now_us
+            };
+            bytes.push_back(byte);
+            if (byte.is_character)
+            {
+                ddram[address] = static_cast<char>(byte.value);
+                address = (address + 1) & 0x7f;
+            }
+            else if (byte.value & 0x80)
+            {
+                address = byte.value & 0x7f;
+            }
+            else if (byte.value == 0x01)
+            {
+                ddram.assign(0x80, ' ');
+                address = 0;
+                ++clears;
+            }
+        }
+    }
+
+    // Steps time until the LCD shows everything, updating it like the main loop would and noting when each byte went out
+    void run(I2C_LCD& lcd)
+    {
+        while (!lcd.is_idle())
+        {
+            lcd.update();
+            Host::advance_time_us(1);
+            decode(Host::get_time_us());
+        }
+    }
+
+    [[nodiscard]] std::string_view line(std::size_t index) const
+    {
+        return std::string_view{ ddram }.substr(index == 0 ? 0x00 : 0x40, I2C_LCD::line_length);
+    }
+};
+
+std::string get_characters(const std::vector<LCDByte>& bytes)
+{
+    std::string characters;
+    for (const LCDByte& byte : bytes)
+    {
+        if (byte.is_character)
+        {
+            characters += static_cast<char>(byte.value);
+        }
+    }
+    return characters;
+}
+}
+
+int main()
+{
+    Host::set_recording(true);
+    LCDModel model;
+
+    const std::uint64_t start_us{ Host::get_time_us() };
+    I2C_LCD lcd;
+    check(Host::get_time_us() == start_us, "Constructing the LCD doesn't wait");
+    model.run(lcd);
+
+    const std::vector<std::uint8_t> init_commands{ 0x03, 0x03, 0x03, 0x02, 0x06, 0x28, 0x0c, 0x01 };
+    check(model.bytes.size() == init_commands.size() + 10, "Start up sends its commands and the digits");
+    for (std::size_t i{ 0 }; i < init_commands.size() && i < model.bytes.size(); ++i)
+    {
+        check(!model.bytes[i].is_character && model.bytes[i].value == init_commands[i], "Start up commands are in order");
+    }
+    check(get_characters(model.bytes) == "0123456789", "Digits follow the start up commands");
+    check(model.bytes.front().sent_at_us >= 40'000, "Nothing is sent until the LCD has powered up");
+
+    // Consecutive bytes are spaced by the transaction and the last byte's execution time, less the time it takes
+    // the next byte's first nibble to reach the LCD
+    constexpr std::uint64_t transaction_us{ (1 + 5 * 9) * 1'000'000 / LCD_I2C_BAUDRATE };
+    constexpr std::uint64_t latch_delay_us{ (1 + 3 * 9) * 1'000'000 / LCD_I2C_BAUDRATE };
+    // The first two function sets of the initialisation sequence need longer than that
+    constexpr std::uint64_t init_waits_us[]{ 4'100, 100 };
+    for (std::size_t i{ 1 }; i < model.bytes.size(); ++i)
+    {
+        const LCDByte& last{ model.bytes[i - 1] };
+        const bool is_slow{ !last.is_character && (last.value & ~1u) <= 0x02 && i > 3 };
+        const std::uint64_t execution_us{ i <= std::size(init_waits_us) ? init_waits_us[i - 1] : is_slow ? 1'520u : 37u };
+        check(model.bytes[i].sent_at_us + latch_delay_us >= last.sent_at_us + transaction_us + execution_us,
+            "Each byte waits for the last to execute");
+    }
+
+    // Updates are queued straight away and go out in order, without clearing the screen
+    const std::uint64_t post_us{ Host::get_time_us() };
+    lcd.display("Hello, LCD");
+    lcd.send_command(I2C_LCD::Command::DisplayControl, I2C_LCD::DisplayFlag::DisplayOn, I2C_LCD::DisplayFlag::CursorOn);
+    lcd.display("A long line that wraps onto two");
+    lcd.move_cursor(1, 14);
+    lcd.display("!!", false);
+    check(Host::get_time_us() == post_us, "Posting to the queue doesn't wait");
+    model.bytes.clear();
+    model.run(lcd);
+    check(model.clears == 1, "Updates don't send ClearDisplay");
+    check(model.line(0) == "A long line that", "First line after the updates");
+    check(model.line(1) == " wraps onto tw!!", "Second line after the updates");
+    std::size_t display_control{ model.bytes.size() };
+    for (std::size_t i{ 0 }; i < model.bytes.size(); ++i)
+    {
+        if (!model.bytes[i].is_character && model.bytes[i].value == 0x0e)
+        {
+            display_control = i;
+        }
+    }
+    check(display_control < model.bytes.size(), "Commands are sent");
+    check(get_characters({ model.bytes.begin(), model.bytes.begin() + static_cast<std::ptrdiff_t>(display_control) }) == "Hello, LCD",
+        "Commands are sent between the displays around them");
+
+    // Changes which don't fit in the queue are picked up by later updates
+    for (std::uint32_t i{ 0 }; i < 20; ++i)
+    {
+        lcd.display(std::string(I2C_LCD::cell_count, static_cast<char>('a' + i)));
+    }
+    lcd.display("Final text");
+    model.run(lcd);
+    check(model.line(0) == "Final text      ", "An overflowing queue catches up on the first line");
+    check(model.line(1) == std::string(I2C_LCD::line_length, ' '), "An overflowing queue catches up on the second line");
+
+    if (failures != 0)
+    {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}
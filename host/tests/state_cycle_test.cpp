@@ -0,0 +1,235 @@
+// Runs the song list, a song and back again many times over, checking that the heap ends every cycle as it ended
+// the first: states live inside Machine, and what they do allocate is freed in the same shape each time.
+// Then plays the song through holds in both blue lanes, which mustn't be taken for the quit gesture.
+#include <malloc.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "hardware/irq.h"
+#include "host/peripherals.h"
+#include "machine.h"
+
+namespace
+{
+constexpr std::uint32_t cycle_count{ 1'000 };
+constexpr std::uint32_t left_blue_pin{ 19 };
+constexpr std::uint32_t right_blue_pin{ 22 };
+// Both blue lanes have a hold over this time, longer than the quit gesture
+constexpr std::uint32_t blue_hold_start_ms{ 1'000 };
+constexpr std::uint32_t blue_hold_length_ms{ 1'500 };
+
+template <typename T>
+void append_bytes(std::vector<std::uint8_t>& bytes, const T& value)
+{
+    const auto* first{ reinterpret_cast<const std::uint8_t*>(&value) };
+    bytes.insert(bytes.end(), first, first + sizeof(T));
+}
+
+bool write_song()
+{
+    Audio::WAVHeader wave{};
+    std::memcpy(wave.magic_riff, "RIFF", 4);
+    std::memcpy(wave.magic_wave, "WAVE", 4);
+    std::memcpy(wave.magic_fmt, "fmt ", 4);
+    std::memcpy(wave.magic_data, "data", 4);
+    wave.format_size = 16;
+    wave.format = Audio::WAVHeader::Format::PCM;
+    wave.channels = 1;
+    wave.samples_per_second = Audio::sample_rate;
+    wave.bytes_per_second = Audio::sample_rate;
+    wave.bytes_per_frame = 1;
+    wave.bits_per_sample = 8;
+    wave.data_size = Audio::sample_rate * 5;
+    std::vector<std::uint8_t> wave_file;
+    append_bytes(wave_file, wave);
+    wave_file.resize(wave_file.size() + wave.data_size, 0x80);
+
+    // Version 1 charts are the notes as they are in memory
+    song_data::Song::Header header{};
+    std::memcpy(header.magic_note, "NOTE", 4);
+    header.version_major = 1;
+    header.ms_per_pixel = 10;
+    header.difficulty = 5;
+    std::vector<song_data::Note> notes;
+    for (std::uint32_t i{ 0 }; i < 200; ++i)
+    {
+        notes.push_back({
+            .note_color = static_cast<song_data::Note::Color>(i % 2),
+            .direction = i % 3 ? song_data::Note::Direction::Left : song_data::Note::Direction::Right,
+            .start_ms = 500 + i * 100,
+            .length_ms = i % 4 == 0 ? 300u : 0u,
+            .speed = 1.0f,
+            .padding = {},
+        });
+    }
+    for (const auto direction : { song_data::Note::Direction::Left, song_data::Note::Direction::Right })
+    {
+        notes.push_back({
+            .note_color = song_data::Note::Color::Blue,
+            .direction = direction,
+            .start_ms = blue_hold_start_ms,
+            .length_ms = blue_hold_length_ms,
+            .speed = 1.0f,
+            .padding = {},
+        });
+    }
+    std::stable_sort(notes.begin(), notes.end(), [](const auto& lhs, const auto& rhs) { return lhs.start_ms < rhs.start_ms; });
+    header.note_count = static_cast<std::uint32_t>(notes.size());
+    std::vector<std::uint8_t> note_file;
+    append_bytes(note_file, header);
+    for (const song_data::Note& note : notes)
+    {
+        append_bytes(note_file, note);
+    }
+    return Host::sd_write_file("/cycle/song.wav", wave_file) && Host::sd_write_file("/cycle/song.note", note_file);
+}
+
+// Updates until the machine is in TState, as the main loop would
+template <typename TState>
+bool update_until(Machine& machine, std::uint64_t timeout_us)
+{
+    const std::uint64_t until_us{ Host::get_time_us() + timeout_us };
+    while (!machine.is_in_state<TState>())
+    {
+        if (Host::get_time_us() > until_us)
+        {
+            return false;
+        }
+        machine.update();
+        Host::advance_time_us(1'000);
+    }
+    return true;
+}
+
+// Lets updates through without pressing anything
+void settle(Machine& machine)
+{
+    for (std::uint32_t i{ 0 }; i < 20; ++i)
+    {
+        machine.update();
+        Host::advance_time_us(1'000);
+    }
+}
+
+// Updates from the start of the song until song_time_ms, firing the audio's sample interrupt as time passes so the
+// song plays as it would on the hardware
+void play_until(Machine& machine, std::uint64_t start_us, std::uint32_t song_time_ms)
+{
+    while (machine.is_in_state<States::PlaySong>() && Host::get_time_us() - start_us < song_time_ms * 1'000ull)
+    {
+        const std::uint64_t before_us{ Host::get_time_us() };
+        machine.update();
+        Host::advance_time_us(1'000);
+        const std::uint64_t samples{ (Host::get_time_us() - start_us) * Audio::sample_rate / 1'000'000 };
+        for (std::uint64_t sample{ (before_us - start_us) * Audio::sample_rate / 1'000'000 }; sample < samples; ++sample)
+        {
+            Host::fire_irq(PWM_IRQ_WRAP);
+        }
+    }
+}
+
+// Plays the song, pressing both blue buttons for the holds in their lanes and keeping them held after
+bool holds_do_not_quit(Machine& machine)
+{
+    Host::set_gpio_input(right_blue_pin, false);
+    if (!update_until<States::PlaySong>(machine, 100'000))
+    {
+        std::printf("The song didn't start\n");
+        return false;
+    }
+    const std::uint64_t start_us{ Host::get_time_us() };
+    Host::set_gpio_input(right_blue_pin, true);
+    play_until(machine, start_us, blue_hold_start_ms);
+    Host::set_gpio_input(left_blue_pin, false);
+    Host::set_gpio_input(right_blue_pin, false);
+    const std::uint32_t hold_end_ms{ blue_hold_start_ms + blue_hold_length_ms };
+    play_until(machine, start_us, hold_end_ms + 500);
+    const bool played_holds{ machine.is_in_state<States::PlaySong>() };
+    play_until(machine, start_us, hold_end_ms + 1'200);
+    const bool quit{ machine.is_in_state<States::SongList>() };
+    Host::set_gpio_input(left_blue_pin, true);
+    Host::set_gpio_input(right_blue_pin, true);
+    settle(machine);
+    if (!played_holds)
+    {
+        std::printf("Holding both blue buttons through holds in their lanes quit the song\n");
+    }
+    else if (!quit)
+    {
+        std::printf("Holding both blue buttons on after the holds didn't quit\n");
+    }
+    return played_holds && quit;
+}
+
+// Selects the song, plays some of it, then quits back to the song list
+bool run_cycle(Machine& machine)
+{
+    Host::set_gpio_input(right_blue_pin, false);
+    if (!update_until<States::PlaySong>(machine, 100'000))
+    {
+        std::printf("The song didn't start\n");
+        return false;
+    }
+    for (std::uint32_t i{ 0 }; i < 50; ++i)
+    {
+        machine.update();
+        Host::advance_time_us(1'000);
+    }
+    Host::set_gpio_input(left_blue_pin, false);
+    const bool quit{ update_until<States::SongList>(machine, 2'000'000) };
+    Host::set_gpio_input(left_blue_pin, true);
+    Host::set_gpio_input(right_blue_pin, true);
+    // Let both releases through before the next press
+    settle(machine);
+    if (!quit)
+    {
+        std::printf("Holding both blue buttons didn't quit\n");
+    }
+    return quit;
+}
+}
+
+int main()
+{
+    if (!write_song())
+    {
+        std::printf("Failed to write the song\n");
+        return 1;
+    }
+    static Machine machine;
+    if (!update_until<States::SongList>(machine, 0))
+    {
+        std::printf("The machine didn't start in the song list\n");
+        return 1;
+    }
+
+    // The first cycle sets up anything which lives for the whole run, like FatFs' buffers
+    if (!run_cycle(machine))
+    {
+        return 1;
+    }
+    const struct mallinfo2 baseline{ mallinfo2() };
+    for (std::uint32_t cycle{ 1 }; cycle < cycle_count; ++cycle)
+    {
+        if (!run_cycle(machine))
+        {
+            std::printf("Failed in cycle %u\n", cycle);
+            return 1;
+        }
+        const struct mallinfo2 heap{ mallinfo2() };
+        if (heap.uordblks != baseline.uordblks || heap.arena > baseline.arena)
+        {
+            std::printf("The heap grew in cycle %u: %zu bytes in use (from %zu), %zu in the arena (from %zu)\n",
+                cycle, heap.uordblks, baseline.uordblks, heap.arena, baseline.arena);
+            return 1;
+        }
+    }
+    std::printf("%u cycles with %zu heap bytes in use after each\n", cycle_count, baseline.uordblks);
+
+    if (!holds_do_not_quit(machine))
+    {
+        return 1;
+    }
+    return 0;
+}
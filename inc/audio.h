@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdint>
+#include <optional>
 #include "sd.h"
 #define AUDIO_PIN 16
 
@@ -34,9 +35,18 @@ struct WAVHeader
     char magic_data[4]; // Should always be "data"
     std::uint32_t data_size;
 };
+static_assert(sizeof(WAVHeader) == 44);
+
+// Playback positions are µs of the wave with this many fractional bits
+constexpr std::uint32_t position_fraction_bits{ 8 };
 
 void init();
 bool start_streaming_wave(SDCard::FileReader wave_file);
 void stream_wave_to_inactive_buffer();
 void stop_streaming_wave();
+// Plays a short click every period_samples in place of a wave, starting at position 0, until stop_streaming_wave
+void start_click_track(std::uint32_t period_samples);
+// How far the playing wave has got, following the sample being output; nullopt once it has stopped.
+// Safe to call while the PWM interrupt runs, and never goes backwards.
+[[nodiscard]] std::optional<std::uint64_t> get_playback_position();
 }
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include "sd.h"
+
+// Latencies measured by States::Calibrate. Songs fold them into their notes as they load.
+struct LatencyOffsets
+{
+    constexpr static const char* file_path{ "/calibration.txt" };
+
+    std::int32_t audio_us{ 0 }; // From a sample leaving the PWM to it being heard
+    std::int32_t visual_us{ 0 }; // From a frame being submitted to it being seen
+    std::int32_t input_us{ 0 }; // From seeing or hearing something to the press being timestamped, player included
+
+    // Reads file_path, which holds lines like "audio_us 12000"
+    [[nodiscard]] static std::optional<LatencyOffsets> load(const SDCard& sd);
+    bool save(SDCard& sd) const;
+};
@@ -1,10 +1,20 @@
 #pragma once
 #include <cstdint>
+#include <optional>
+#include "spsc_queue.h"
 
+// Buttons are sampled by GPIO interrupts: each edge is stamped with time_us_64 as it happens and queued for update,
+// so presses are timed to the microsecond and a tap between two updates is never missed.
 class Button
 {
 public:
-    Button(std::uint32_t gpio_pin);
+    // Edges within debounce_us of the last accepted one are ignored; update checks the level again once it passes
+    constexpr static std::uint32_t default_debounce_us{ 5'000 };
+
+    Button(std::uint32_t gpio_pin, std::uint32_t debounce_us = default_debounce_us);
+    Button(const Button&) = delete;
+    Button& operator=(const Button&) = delete;
+    ~Button();
 
     enum class State : std::uint8_t
     {
@@ -15,6 +25,13 @@ public:
         Released,
     };
 
+    struct Event
+    {
+        std::uint64_t time_us;
+        bool is_press;
+    };
+
+    // Moves the state on by at most one queued event, so a press and release between two updates are seen in turn
     void update();
 
     [[nodiscard]] inline const State& get_state() const
@@ -22,7 +39,26 @@ public:
         return last_state;
     }
 
+    // When the press or release behind the current state happened
+    [[nodiscard]] inline std::uint64_t get_changed_at_us() const
+    {
+        return changed_at_us;
+    }
+
 private:
+    static void on_gpio_edge(uint gpio, std::uint32_t events);
+    // Queues an edge unless it repeats the last one or is within the debounce time. Called with interrupts disabled.
+    void record_edge(std::uint64_t time_us, bool is_press);
+    void accept_edge(std::uint64_t time_us, bool is_press);
+
     std::uint32_t gpio_pin;
+    std::uint32_t debounce_us;
     State last_state{ State::Uninitialized };
+    std::uint64_t changed_at_us{ 0 };
+
+    spsc_queue<Event, 16> events;
+    // Only touched with interrupts disabled
+    bool is_pressed{ false };
+    std::uint64_t debounced_at_us{ 0 };
+    std::optional<std::uint64_t> ignored_at_us; // The last edge ignored since the last accepted one
 };
@@ -0,0 +1,93 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <optional>
+#include "song_data.h"
+
+namespace song_data
+{
+// Matches presses and releases against the notes of a Song. Times are µs of song time, as from a button's timestamp.
+// Each of the six lanes (direction × color) keeps a cursor on its next unjudged note, so judging never searches the
+// chart: a cursor only moves forward, passing each note once.
+class Judge
+{
+public:
+    enum class Grade : std::uint8_t
+    {
+        Perfect,
+        Good,
+        Miss,
+    };
+
+    // Half-widths: a press at most perfect_us from a note's start is Perfect, then Good up to good_us
+    struct Windows
+    {
+        std::uint32_t perfect_us;
+        std::uint32_t good_us;
+    };
+
+    // Indexed by Header::difficulty - 1; tighter as the charts get harder
+    constexpr static std::array<Windows, 10> difficulty_windows{ {
+        { 60'000, 150'000 },
+        { 56'000, 142'000 },
+        { 52'000, 134'000 },
+        { 48'000, 126'000 },
+        { 44'000, 118'000 },
+        { 40'000, 110'000 },
+        { 36'000, 102'000 },
+        { 32'000, 94'000 },
+        { 28'000, 86'000 },
+        { 25'000, 80'000 },
+    } };
+    constexpr static std::array<std::uint32_t, 3> grade_points{ 300, 100, 0 };
+    constexpr static std::size_t lane_count{ 6 };
+
+    struct Stats
+    {
+        std::array<std::uint32_t, 3> grades{}; // Heads and hold ends, indexed by Grade
+        std::uint32_t combo{ 0 };
+        std::uint32_t max_combo{ 0 };
+    };
+
+    Judge() = default;
+    explicit Judge(std::uint8_t difficulty);
+
+    [[nodiscard]] constexpr static std::size_t get_lane(Note::Color note_color, Note::Direction direction)
+    {
+        return direction * 3 + note_color;
+    }
+
+    // Each returns the points earned. A press takes the next note in its lane if it is within the good window;
+    // a hold then runs until the release, which must come no earlier than good_us before its end.
+    // Only the event's own lane is moved on to time_us, so events in different lanes may be judged in any order.
+    std::uint32_t press(const Song& song, std::size_t lane, std::int64_t time_us);
+    std::uint32_t release(const Song& song, std::size_t lane, std::int64_t time_us);
+    // Moves every lane on to time_us, as update_lane
+    std::uint32_t update(const Song& song, std::int64_t time_us);
+
+    [[nodiscard]] bool is_holding(std::size_t lane) const { return lanes[lane].hold_end_us.has_value(); }
+    // Chart index of the earliest note a lane may still judge; streaming has to keep it and every note after it
+    [[nodiscard]] std::size_t get_first_unjudged_note() const;
+
+    [[nodiscard]] const Windows& get_windows() const { return windows; }
+    [[nodiscard]] const Stats& get_stats() const { return stats; }
+
+private:
+    struct Lane
+    {
+        std::size_t cursor{ 0 }; // Chart index of the next note to judge, or somewhere before it
+        std::optional<std::int64_t> hold_end_us; // Set while a hold in this lane is being held
+    };
+
+    // Misses notes whose window has closed and finishes a hold which is still held at its end
+    std::uint32_t update_lane(const Song& song, std::size_t lane_index, std::int64_t time_us);
+    // Moves the lane's cursor onto its next note in song.notes and returns that note's index there, if it is loaded
+    std::optional<std::size_t> find_next_note(const Song& song, Lane& lane, std::size_t lane_index);
+    [[nodiscard]] Grade grade_offset(std::int64_t offset_us) const;
+    std::uint32_t score(Grade grade);
+
+    Windows windows{ difficulty_windows[4] };
+    std::array<Lane, lane_count> lanes{};
+    Stats stats;
+};
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <array>
 #include <cstdint>
 #include <string_view>
 #include "pico/stdlib.h"
@@ -15,6 +16,8 @@ static_assert(LCD_SDA_PIN % 2 == 0, "LCD_SDA_PIN must be a multiple of 2");
 #endif
 
 #define LCD_I2C_ADDR 0x27
+// PCF8574 backpacks are only rated for 100kHz but generally run at 400kHz; drop to 100'000 if characters come out garbled
+#define LCD_I2C_BAUDRATE 400'000
 
 void scan_i2c_bus();
 
@@ -23,6 +26,9 @@ inline void i2c_write_byte(std::uint8_t byte)
     i2c_write_blocking(LCD_I2C_CHANNEL, LCD_I2C_ADDR, &byte, 1, false);
 }
 
+// Bytes for the LCD are queued and sent in the background: a DMA channel feeds each one to the I2C controller as a
+// transaction, and a hardware alarm starts the next once the HD44780 has had time to execute the last.
+// Only one I2C_LCD can exist, since the alarm's callback has no way to find its owner.
 class I2C_LCD
 {
 public:
@@ -58,8 +64,13 @@ public:
         BacklightOn = 1 << 3,
     };
 
+    constexpr static std::size_t line_count{ 2 };
+    constexpr static std::size_t line_length{ 16 };
+    constexpr static std::size_t cell_count{ line_count * line_length };
+
     I2C_LCD();
 
+    // Writes at the cursor, like display(std::string_view{ &character, 1 }, false)
     void send_character(char character);
 
     template <typename ...TCommandFlags>
@@ -73,19 +84,87 @@ public:
 
     void send_command(Command command);
 
+    // Blanks the screen by overwriting the characters shown; ClearDisplay is only sent at start up
     void clear();
 
+    // Writes str into the screen from the cursor, running onto the second line, then sends only the cells which changed
     void display(std::string_view str, bool clear_first = true);
 
+    // Where the next display(str, false) writes
     void move_cursor(std::uint8_t line, std::uint8_t position);
 
+    // Queues any cells left over from a display which found the queue full
+    void update();
+
+    // True once the LCD shows everything displayed, so nothing is left for update to queue or the alarm to send
+    [[nodiscard]] bool is_idle() const;
+
 private:
+    constexpr static std::uint8_t unknown_address{ 0xff };
+    // HD44780 execution times at 270kHz, scaled to the slowest oscillator the datasheet allows (190kHz)
+    constexpr static std::uint32_t execution_us{ 37 * 270 / 190 };
+    constexpr static std::uint32_t clear_execution_us{ 1520 * 270 / 190 }; // ClearDisplay and ReturnHome
+    // The 4-bit initialisation sequence's first two function sets need longer than any command takes to execute: more
+    // than 4.1ms after the first and more than 100us after the second
+    constexpr static std::uint32_t first_init_us{ 4'100 + 100 };
+    constexpr static std::uint32_t second_init_us{ 100 + 50 };
+    // The first nibble of a byte is latched once the start, address and two bytes of its transaction are on the bus
+    constexpr static std::uint32_t latch_delay_us{ (1 + 3 * 9) * 1'000'000 / LCD_I2C_BAUDRATE };
+    // Start, address and the four bytes of a sequence, rounded up
+    constexpr static std::uint32_t transaction_us{ (1 + 5 * 9) * 1'000'000 / LCD_I2C_BAUDRATE + 1 };
+    // The HD44780 needs 40ms after power rises before it takes commands
+    constexpr static std::uint64_t power_on_us{ 40'000 };
+
+    [[nodiscard]] constexpr static std::uint8_t get_cell_address(std::size_t cell)
+    {
+        return static_cast<std::uint8_t>((cell < line_length ? 0x00 : 0x40) + cell % line_length);
+    }
+
+    void write_cell(char character);
+    // Sends the dirty cells in order, moving the LCD's cursor only where they aren't next to each other
+    void flush();
+    // Follows the LCD's address counter and contents through the commands sent
+    void track_command(std::uint8_t command);
+
     enum class SendMode : std::uint8_t {
         Command = 0,
         Character = 1,
     };
 
-    void toggle_enable(std::uint8_t val);
- 
-    void send_byte(std::uint8_t byte, SendMode mode);
+    [[nodiscard]] constexpr static std::uint32_t get_execution_us(std::uint8_t byte, SendMode mode)
+    {
+        const bool is_slow_command{
+            mode == SendMode::Command && (byte & ~1u) <= static_cast<std::uint8_t>(Command::ReturnHome)
+        };
+        return is_slow_command ? clear_execution_us : execution_us;
+    }
+
+    // Queues a byte, waiting for space if the queue is full
+    void send_byte(std::uint8_t byte, SendMode mode) { send_byte(byte, mode, get_execution_us(byte, mode)); }
+    // As above, but the next byte is held back for wait_us after this one rather than its execution time
+    void send_byte(std::uint8_t byte, SendMode mode, std::uint32_t wait_us);
+    // Queues a byte and starts sending if the LCD is idle; the LCD's state is tracked as if it had already been sent
+    void post(std::uint8_t byte, SendMode mode, std::uint32_t wait_us);
+    [[nodiscard]] std::size_t get_free_slots() const;
+    // Starts the transaction for the next queued byte and sets the alarm for when the LCD will be ready after it.
+    // Runs from the alarm's interrupt, or with interrupts disabled.
+    void send_next();
+    static void on_alarm(uint alarm_num);
+
+    std::array<char, cell_count> screen; // What should be shown
+    std::array<char, cell_count> shown; // What the LCD shows
+    std::uint32_t dirty_cells{ 0 }; // Bit n is set while cell n of screen differs from shown
+    std::size_t cursor_cell{ 0 };
+    std::uint8_t address{ unknown_address }; // The LCD's DDRAM address counter
+
+    // Entries are the byte, the SendMode above it and the wait after it in the top half. The main loop only moves the
+    // tail and send_next the head.
+    std::array<std::uint32_t, 64> queue;
+    volatile std::uint32_t queue_head{ 0 };
+    volatile std::uint32_t queue_tail{ 0 };
+    volatile bool sending{ false }; // Set from the start of a transaction until the LCD has executed the last byte
+    std::uint64_t ready_at_us{ power_on_us }; // When the LCD can take the next byte, once sending is clear
+    std::array<std::uint32_t, 4> dma_words; // Words for the I2C controller's data_cmd register
+    std::uint32_t dma_channel;
+    std::uint32_t alarm;
 };
\ No newline at end of file
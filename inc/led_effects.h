@@ -0,0 +1,119 @@
+#pragma once
+#include <array>
+#include <concepts>
+#include <cstdint>
+#include <tuple>
+#include "leds.h"
+
+// Layers for LEDs::show_pattern. Each layer gets the pixel index and the color from the layers under it; a pipeline
+// runs every layer for a pixel in turn, so the whole effect is inlined into one pass over the frame.
+namespace led_effects
+{
+template <typename T>
+concept layer = requires(const T& effect, std::uint32_t pixel_index, packed_color below) {
+    { effect(pixel_index, below) } -> std::same_as<packed_color>;
+};
+
+template <layer... Layers>
+struct pipeline {
+    std::tuple<Layers...> layers;
+
+    constexpr explicit pipeline(Layers... layers) : layers{ layers... } {}
+
+    constexpr packed_color operator()(std::uint32_t pixel_index) const
+    {
+        return std::apply([pixel_index](const Layers&... layer) {
+            packed_color c{ packed_colors::black };
+            ((c = layer(pixel_index, c)), ...);
+            return c;
+        }, layers);
+    }
+};
+
+// Snakes with a bright head and a dim tail, which move one LED per tick and take turns through the colors
+template <std::uint32_t spacing = 64, std::uint32_t length = 10>
+struct snakes {
+    constexpr static std::array<packed_color, 3> snake_colors{ packed_colors::red, packed_colors::green, packed_colors::blue };
+    constexpr static std::uint32_t loop_ticks{ spacing * snake_colors.size() };
+
+    std::uint32_t t;
+
+    constexpr packed_color operator()(std::uint32_t pixel_index, packed_color below) const
+    {
+        const std::uint32_t x{ (pixel_index + t) % spacing };
+        if (x >= length)
+        {
+            return below;
+        }
+        const packed_color c{ snake_colors[((pixel_index + t) % loop_ticks) / spacing] };
+        return below + (x == 0 ? c : c * brightnesses::dim);
+    }
+};
+
+// Blends from one color to another along a run of LEDs
+struct gradient {
+    packed_color from;
+    packed_color to;
+    std::uint32_t first_led{ 0 };
+    std::uint32_t length{ led_count };
+
+    constexpr packed_color operator()(std::uint32_t pixel_index, packed_color below) const
+    {
+        const std::uint32_t offset{ pixel_index - first_led };
+        if (offset >= length)
+        {
+            return below;
+        }
+        const brightness amount{ brightness::from_fraction(offset, length > 1 ? length - 1 : 1) };
+        const brightness remaining{ static_cast<std::uint16_t>(brightness::full_value - amount.value) };
+        return below + from * remaining + to * amount;
+    }
+};
+
+// Scales everything under it
+struct fade {
+    brightness level;
+
+    constexpr packed_color operator()([[maybe_unused]] std::uint32_t pixel_index, packed_color below) const
+    {
+        return below * level;
+    }
+};
+
+// Lights the whole ring at the start of every period, fading out over duration ticks
+struct flash {
+    packed_color flash_color;
+    std::uint32_t t;
+    std::uint32_t period;
+    std::uint32_t duration;
+
+    constexpr packed_color operator()([[maybe_unused]] std::uint32_t pixel_index, packed_color below) const
+    {
+        const std::uint32_t age{ t % period };
+        if (age >= duration)
+        {
+            return below;
+        }
+        return below + flash_color * brightness::from_fraction(duration - age, duration);
+    }
+};
+
+using frame = std::array<packed_color, led_count>;
+
+// Renders a looping animation ahead of time, where make_effect(t) gives the effect for tick t.
+// Kept in a constexpr variable the table lives in flash, and showing a frame is just a copy.
+template <std::size_t frame_count, typename MakeEffect>
+consteval std::array<frame, frame_count> bake(MakeEffect make_effect)
+{
+    std::array<frame, frame_count> frames{};
+    for (std::uint32_t t{ 0 }; t < frame_count; ++t)
+    {
+        const auto effect{ make_effect(t) };
+        for (std::uint32_t i{ 0 }; i < led_count; ++i)
+        {
+            frames[t][i] = effect(i);
+        }
+    }
+    return frames;
+}
+}
@@ -1,42 +1,159 @@
 #pragma once
+#include <algorithm>
 #include <array>
-#include <cmath>
 #include <cstdint>
-#include <functional>
 #include <span>
+#include <type_traits>
 
 #define LED_IS_RGBW false
 #define LED_DATA_PIN 15
+// What the LEDs may draw from the 5V supply; brighter frames are scaled down as they are encoded
+#define LED_CURRENT_BUDGET_MA 1000
+// Attract mode shows snakes from a table in flash (about 34KB) instead of computing each frame
+#define LED_BAKED_ATTRACT_MODE false
 constexpr std::size_t led_count{ 45 };
 constexpr bool using_sacrificial_led{ true };
 constexpr std::size_t visible_led_count{ led_count - (using_sacrificial_led ? 1 : 0) };
 
+// More than one segment drives the ring on consecutive pins from LED_DATA_PIN with the ws2812_parallel program,
+// which sends every segment at once and divides the time a frame takes on the wire by the segment count.
+// The sacrificial LED only shifts the level of the first segment's data line.
+#define LED_SEGMENT_COUNT 1
+struct led_segment {
+    std::size_t first_led;
+    std::size_t length;
+    bool reversed; // Data enters at the segment's last LED, e.g. when two halves are fed from the middle
+};
+constexpr std::array<led_segment, LED_SEGMENT_COUNT> led_segments{ [] {
+    // Even split; replace with a table to match the wiring
+    std::array<led_segment, LED_SEGMENT_COUNT> segments{};
+    std::size_t first_led{ 0 };
+    for (std::size_t i{ 0 }; i < segments.size(); ++i)
+    {
+        const std::size_t length{ (led_count - first_led) / (segments.size() - i) };
+        segments[i] = { first_led, length, false };
+        first_led += length;
+    }
+    return segments;
+}() };
+constexpr std::size_t longest_led_segment{ std::max_element(
+    led_segments.begin(), led_segments.end(),
+    [](const led_segment& lhs, const led_segment& rhs) { return lhs.length < rhs.length; }
+)->length };
+static_assert(LED_SEGMENT_COUNT >= 1 && LED_SEGMENT_COUNT <= 8, "Frames are transposed a byte at a time, so up to 8 segments are supported");
+static_assert(LED_SEGMENT_COUNT == 1 || !LED_IS_RGBW, "ws2812_parallel sends 24 bits per LED");
+
 struct color {
     std::uint8_t r, g, b;
-    inline color operator*(float f) const
+};
+
+// Colors are kept by perceived brightness and put through this curve on their way to the strip,
+// so fades and trails look even instead of jumping at the dark end
+namespace gamma_curve {
+    // x^2.2 for x from 0 to 1, worked out as x^2 times the fifth root of x
+    constexpr double to_light(double x)
     {
-        return {
-            static_cast<std::uint8_t>(std::floor(r * f)),
-            static_cast<std::uint8_t>(std::floor(g * f)),
-            static_cast<std::uint8_t>(std::floor(b * f))
-        };
+        double root{ 1.0 };
+        for (int i{ 0 }; i < 32 && x > 0; ++i)
+        {
+            root -= (root * root * root * root * root - x) / (5 * root * root * root * root);
+        }
+        return x > 0 ? x * x * root : 0;
+    }
+
+    // The inverse of to_light
+    constexpr double to_perceived(double light)
+    {
+        double low{ 0 };
+        double high{ 1 };
+        for (int i{ 0 }; i < 48; ++i)
+        {
+            const double middle{ (low + high) / 2 };
+            (to_light(middle) < light ? low : high) = middle;
+        }
+        return high;
     }
-    inline color& operator*=(float f)
+
+    // Wire levels in 8.8 fixed point, so the dark end keeps the steps between levels
+    constexpr std::array<std::uint16_t, 256> table{ [] {
+        std::array<std::uint16_t, 256> levels{};
+        for (std::size_t i{ 0 }; i < levels.size(); ++i)
+        {
+            levels[i] = static_cast<std::uint16_t>(to_light(i / 255.0) * (255 << 8) + 0.5);
+        }
+        return levels;
+    }() };
+}
+
+// Fixed-point scale for colors with 8 fractional bits, so full is exactly 1 and nothing needs floats
+struct brightness {
+    constexpr static std::uint32_t fraction_bits{ 8 };
+    constexpr static std::uint16_t full_value{ 1 << fraction_bits };
+
+    std::uint16_t value; // 0 to full_value
+
+    // Rounds to the nearest step
+    constexpr static brightness from_fraction(std::uint32_t numerator, std::uint32_t denominator)
+    {
+        return { static_cast<std::uint16_t>(((numerator << fraction_bits) + denominator / 2) / denominator) };
+    }
+    // For colors going through the gamma curve: scales the light given off rather than the perceived brightness
+    consteval static brightness from_light_fraction(std::uint32_t numerator, std::uint32_t denominator)
+    {
+        const double perceived{ gamma_curve::to_perceived(static_cast<double>(numerator) / denominator) };
+        return { static_cast<std::uint16_t>(perceived * full_value + 0.5) };
+    }
+};
+namespace brightnesses {
+    constexpr brightness full{ brightness::full_value };
+    // Hold trails and snake tails give off a tenth of the light of a head
+    constexpr brightness dim{ brightness::from_light_fraction(1, 10) };
+}
+
+// A color packed as 0x00GGRRBB, the order WS2812s expect, so channels are scaled and mixed a word at a time
+struct packed_color {
+    std::uint32_t grb;
+
+    constexpr static packed_color pack(color c)
     {
-        return *this = *this * f;
+        return { (static_cast<std::uint32_t>(c.g) << 16) | (static_cast<std::uint32_t>(c.r) << 8) | c.b };
     }
-    inline color operator+(const color& c) const
+    [[nodiscard]] constexpr color unpack() const
     {
         return {
-            static_cast<std::uint8_t>(std::clamp(r + c.r, 0, 255)),
-            static_cast<std::uint8_t>(std::clamp(g + c.g, 0, 255)),
-            static_cast<std::uint8_t>(std::clamp(b + c.b, 0, 255))
+            static_cast<std::uint8_t>(grb >> 8),
+            static_cast<std::uint8_t>(grb >> 16),
+            static_cast<std::uint8_t>(grb)
         };
     }
-    inline color& operator+=(const color& c)
+    // Rounds each channel down
+    constexpr packed_color operator*(brightness scale) const
+    {
+        // With scale at most 256, each channel times scale fits in 16 bits, so two channels can share a multiply
+        const std::uint32_t green_blue{ (((grb & 0x00ff00ff) * scale.value) >> brightness::fraction_bits) & 0x00ff00ff };
+        const std::uint32_t red{ (((grb >> 8) & 0xff) * scale.value) >> brightness::fraction_bits };
+        return { green_blue | (red << 8) };
+    }
+    constexpr packed_color& operator*=(brightness scale)
+    {
+        return *this = *this * scale;
+    }
+    // Adds each channel, saturating at 0xff
+    constexpr packed_color operator+(packed_color c) const
+    {
+        constexpr std::uint32_t high_bits{ 0x80808080 };
+        constexpr std::uint32_t low_bits{ ~high_bits };
+        // Adding the low 7 bits of each channel can't carry into the next one; the top bits are then added by hand
+        const std::uint32_t low_sum{ (grb & low_bits) + (c.grb & low_bits) };
+        const std::uint32_t sum{ low_sum ^ ((grb ^ c.grb) & high_bits) };
+        const std::uint32_t carries{ ((grb & c.grb) | ((grb ^ c.grb) & low_sum)) & high_bits };
+        return { sum | ((carries >> 7) * 0xff) };
+    }
+    constexpr packed_color& operator+=(packed_color c)
     {
         return *this = *this + c;
     }
+    constexpr bool operator==(const packed_color&) const = default;
 };
 namespace colors {
     constexpr color black{ 0x00, 0x00, 0x00 };
@@ -45,21 +162,112 @@ namespace colors {
     constexpr color blue{ 0x00, 0x00, 0xff };
     constexpr color white{ 0xff, 0xff, 0xff };
 }
+namespace packed_colors {
+    constexpr packed_color black{ packed_color::pack(colors::black) };
+    constexpr packed_color red{ packed_color::pack(colors::red) };
+    constexpr packed_color green{ packed_color::pack(colors::green) };
+    constexpr packed_color blue{ packed_color::pack(colors::blue) };
+    constexpr packed_color white{ packed_color::pack(colors::white) };
+}
 
+// Frames are sent to the strip by DMA while the caller carries on. show_pattern encodes a frame into the back buffer,
+// through the gamma curve and global brightness;
+// if the front buffer is still on the wire, the newest frame waits there until update sends it.
 class LEDs {
 public:
+    constexpr static std::uint32_t bit_frequency{ 800'000 };
+    constexpr static std::uint32_t bits_per_led{ 24 };
+    // Low time which makes the strip latch a frame; WS2812B-V5 parts need 280us, older ones 50us
+    constexpr static std::uint32_t reset_us{ 300 };
+    constexpr static std::uint32_t frame_time_us{ longest_led_segment * bits_per_led * 1'000'000 / bit_frequency + reset_us };
+
+    // Estimated WS2812 draw: per channel at full duty, and per LED with everything off
+    constexpr static std::uint32_t channel_ma{ 20 };
+    constexpr static std::uint32_t idle_ma_per_led{ 1 };
+    constexpr static std::uint32_t current_budget_ma{ LED_CURRENT_BUDGET_MA };
+    static_assert(current_budget_ma > idle_ma_per_led * led_count, "The budget must cover the LEDs' idle draw");
+
+    struct CurrentStats {
+        std::uint32_t frames{ 0 };
+        std::uint32_t limited_frames{ 0 }; // Frames which were scaled down to fit the budget
+        std::uint32_t peak_ma{ 0 }; // Highest estimate before limiting
+    };
+
     LEDs();
 
-    void put_pixel(color pixel);
     void clear();
     void pattern_snakes(std::uint32_t t);
-    void show_pattern(std::span<const color> pattern);
-    void show_pattern(const std::array<color, led_count>& pattern);
-    void show_pattern(const std::array<color, visible_led_count>& pattern);
-    void show_pattern(std::function<color (std::uint32_t pixel_index)> generator);
-    const color& get_pixel(std::size_t index) const;
+    void show_pattern(std::span<const packed_color> pattern);
+    void show_pattern(const std::array<packed_color, led_count>& pattern);
+    void show_pattern(const std::array<packed_color, visible_led_count>& pattern);
+    // Calls effect(pixel_index) for every LED in one inlined pass; see led_effects.h
+    template <typename Effect>
+        requires std::is_invocable_r_v<packed_color, const Effect&, std::uint32_t>
+    void show_pattern(const Effect& effect)
+    {
+        for (std::uint32_t i{ 0 }; i < led_count; ++i)
+        {
+            pixels[i] = effect(i);
+        }
+        submit_pixels();
+    }
+    // Starts sending the waiting frame once the last one has latched
+    void update();
+    // True once the newest frame is latched on the strip
+    [[nodiscard]] bool is_frame_done() const;
+    // From the newest frame, even if it is still waiting to be sent; before gamma and global brightness
+    color get_pixel(std::size_t index) const;
+    // Scales the light of every LED, applied as frames are encoded
+    void set_brightness(brightness level);
+    [[nodiscard]] brightness get_brightness() const { return global_brightness; }
+    [[nodiscard]] const CurrentStats& get_current_stats() const { return current_stats; }
 
 private:
-    std::size_t next_pixel{ 0 };
-    std::array<color, led_count> pixels;
+    // One left aligned GRB word per LED for a single pin; for segments, one word per bit with bit n for pin n
+    constexpr static std::size_t frame_word_count{ LED_SEGMENT_COUNT == 1 ? led_count : longest_led_segment * bits_per_led };
+    using frame_buffer = std::array<std::uint32_t, frame_word_count>;
+
+    [[nodiscard]] frame_buffer& get_back_buffer() { return frames[front_index ^ 1]; }
+    [[nodiscard]] bool is_wire_idle() const;
+    // Wire levels below this keep their fraction, which is dithered over frames; steps above it are too small to see
+    constexpr static std::uint32_t dither_below{ 32 << 8 };
+    // Added to the fraction before rounding; spread so the average over a cycle is half a level
+    constexpr static std::array<std::uint8_t, 8> dither_thresholds{ 16, 144, 80, 208, 48, 176, 112, 240 };
+    // Sum of 8.8 channel levels which keeps the estimate within the budget, even if every channel is dithered up
+    constexpr static std::uint32_t max_level_sum{
+        ((current_budget_ma - idle_ma_per_led * led_count) * 255 / channel_ma - 3 * led_count) << 8
+    };
+
+    constexpr static std::array<std::uint16_t, 256> make_channel_levels(brightness level)
+    {
+        std::array<std::uint16_t, 256> levels{};
+        for (std::size_t i{ 0 }; i < levels.size(); ++i)
+        {
+            const std::uint32_t light{ (std::uint32_t{ gamma_curve::table[i] } * level.value) >> brightness::fraction_bits };
+            levels[i] = static_cast<std::uint16_t>(light < dither_below ? light : (light + 0x80) & ~0xffu);
+        }
+        return levels;
+    }
+
+    [[nodiscard]] constexpr static std::uint32_t estimate_ma(std::uint32_t level_sum)
+    {
+        return idle_ma_per_led * led_count + (level_sum >> 8) * channel_ma / 255;
+    }
+    // Encodes the newest frame into the back buffer, putting each channel through level (which gives 8.8 fixed point)
+    // and dithering the fraction; returns the sum of levels before dithering
+    template <typename Level>
+    std::uint32_t encode_pixels(Level level);
+    void submit_pixels();
+    void start_transfer();
+
+    std::array<packed_color, led_count> pixels{}; // The newest frame
+    brightness global_brightness{ brightnesses::full };
+    std::array<std::uint16_t, 256> channel_levels{ make_channel_levels(brightnesses::full) }; // Gamma then global brightness
+    std::uint32_t dither_frame{ 0 };
+    CurrentStats current_stats{};
+    std::array<frame_buffer, 2> frames{};
+    std::size_t front_index{ 0 }; // The frame last put on the wire
+    bool frame_waiting{ false };
+    std::uint32_t dma_channel;
+    std::uint64_t latched_at_us{ 0 };
 };
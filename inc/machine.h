@@ -1,38 +1,110 @@
 #pragma once
-#include <memory>
+#include <array>
+#include <optional>
+#include <variant>
 #include "audio.h"
+#include "calibration.h"
 #include "input.h"
+#include "judge.h"
 #include "lcd.h"
 #include "leds.h"
 #include "sd.h"
-#include "state.h"
 #include "song_data.h"
 
+struct Machine;
+
+// States live in place inside Machine and are called without virtual dispatch. Each has a constructor taking the
+// Machine and operator()(Machine&), and may have refill_streams(Machine&), which tops up anything read from the SD
+// card during play and runs next to the audio streaming.
 namespace States
 {
-    class SongList : public State
+    class SongList
     {
     private:
-        std::vector<std::string> songs;
+        constexpr static std::size_t max_song_count{ 64 };
+        constexpr static std::size_t name_pool_size{ 1024 };
+
+        [[nodiscard]] const char* get_song_name(std::size_t index) const;
+
+        // Names of the song directories, one after another with their null terminators
+        std::array<char, name_pool_size> name_pool;
+        std::array<std::uint16_t, max_song_count> name_offsets;
+        std::size_t song_count{ 0 };
         std::uint32_t last_song_index{~0u};
         std::size_t current_index{0};
         
     public:
         SongList(Machine &machine);
-        void operator()(Machine &machine) override;
+        void operator()(Machine &machine);
+    };
+
+    // Measures LatencyOffsets: the player taps along to a click, then to the ring flashing, and the median distance
+    // of the taps from the beats gives the latencies
+    class Calibrate
+    {
+    private:
+        constexpr static std::uint32_t beat_samples{ Audio::sample_rate / 2 };
+        constexpr static std::int64_t beat_us{ 500'000 };
+        constexpr static std::uint64_t flash_us{ 100'000 };
+        constexpr static std::size_t taps_per_phase{ 16 };
+
+        enum class Phase : std::uint8_t
+        {
+            Audio,
+            Visual,
+            Done,
+        };
+
+        // When the button pressed this update was pressed, if any was
+        [[nodiscard]] static std::optional<std::uint64_t> get_tap_us(Machine& machine);
+        // Keeps a tap's distance from the nearest beat; true once the phase has all its taps
+        bool record_tap(std::int64_t since_beat_us);
+        [[nodiscard]] std::int32_t take_median_tap();
+        void finish(Machine& machine, std::int32_t visual_tap_us);
+
+        Phase phase{ Phase::Audio };
+        std::array<std::int32_t, taps_per_phase> taps{};
+        std::size_t tap_count{ 0 };
+        std::int32_t audio_tap_us{ 0 };
+        std::uint64_t visual_started_at_us{ 0 };
+        std::uint64_t last_flash_at_us{ 0 };
+        std::uint64_t flash_count{ 0 };
+        bool flash_lit{ false };
+
+    public:
+        Calibrate(Machine& machine);
+        void operator()(Machine& machine);
     };
 
-    class PlaySong : public State
+    class PlaySong
     {
     private:
+        // Charts longer than this are streamed from the SD card while playing
+        constexpr static std::uint32_t max_loaded_note_count{ 4096 };
+        // Holding both blue buttons this long goes back to the song list. Time spent holding a note in either blue lane
+        // doesn't count, so a chart's holds can't end the song.
+        constexpr static std::uint64_t quit_hold_us{ 1'000'000 };
+
         std::uint32_t score{ 0u };
         void increment_score(Machine& machine, std::uint32_t val);
+        // Feeds presses and releases since the last update to the judge, timed from when they happened
+        void judge_buttons(Machine& machine);
+        // Follows the audio's playback position, or the clock while no audio plays
+        void update_timeline();
+        // Song time in µs of something which happened at time_us, a time_us_64
+        [[nodiscard]] std::int64_t get_song_time_us(std::uint64_t time_us) const;
         song_data::Song song;
-        std::uint64_t last_update_ms{ ~0ull };
+        song_data::Judge judge;
+        std::uint64_t song_position{ 0 }; // µs with Audio::position_fraction_bits of fraction
+        std::uint64_t position_at_us{ ~0ull }; // The time_us_64 song_position was taken at
+        std::uint32_t last_rendered_ms{ ~0u };
+        bool heard_audio{ false }; // The song ends once its audio has played out
+        std::optional<std::uint64_t> quit_held_since_us;
 
     public:
         PlaySong(Machine& machine);
-        void operator()(Machine& machine) override;
+        void operator()(Machine& machine);
+        void refill_streams(Machine& machine);
     };
 }
 
@@ -42,10 +114,19 @@ struct Machine
 
     void update();
 
+    // The new state is built at the end of update, once the current one has been destroyed
     template <typename TState>
     void switch_state()
     {
-        next_state = std::make_unique<TState>(*this);
+        enter_next_state = [](Machine& machine) {
+            machine.current_state.template emplace<TState>(machine);
+        };
+    }
+
+    template <typename TState>
+    [[nodiscard]] bool is_in_state() const
+    {
+        return std::holds_alternative<TState>(current_state);
     }
 
     I2C_LCD lcd;
@@ -63,11 +144,12 @@ struct Machine
 
     [[nodiscard]] inline std::uint32_t get_current_tick() { return current_tick; }
     
-    std::string current_song_path;
+    std::array<char, FF_MAX_LFN + 1> current_song_path{}; // The song's directory
+    LatencyOffsets latency_offsets;
 
 private:
     std::uint32_t current_tick{0};
 
-    std::unique_ptr<State> current_state;
-    std::unique_ptr<State> next_state;
+    std::variant<std::monostate, States::SongList, States::PlaySong, States::Calibrate> current_state;
+    void (*enter_next_state)(Machine& machine){ nullptr };
 };
@@ -7,6 +7,7 @@
 #include <span>
 #include <string_view>
 #include <sstream>
+#include <type_traits>
 #include <vector>
 #include "ff.h"
 
@@ -93,6 +94,7 @@ public:
         }
 
         GETTER constexpr FSIZE_t get_current_offset() const { return current_offset; }
+        GETTER FSIZE_t get_size() const { return f_size(&file_handle); }
 
     protected:
         FIL file_handle;
@@ -117,18 +119,16 @@ public:
         template <typename TData>
         bool read(TData &out_object)
         {
+            static_assert(std::is_trivially_copyable_v<TData>, "FileReader::read can only fill trivially copyable objects");
             if (!is_valid())
             {
                 return false;
             }
-            constexpr static std::size_t object_size{sizeof(TData)};
-            std::array<std::uint8_t, object_size> buffer;
-            if (!read_bytes(std::span{buffer.data(), object_size}))
+            if (!read_bytes(std::span{reinterpret_cast<std::uint8_t *>(&out_object), sizeof(TData)}))
             {
                 print("FileReader failed to read_bytes for object\n");
                 return false;
             }
-            std::memcpy(&out_object, buffer.data(), buffer.size());
             return true;
         }
 
@@ -144,11 +144,12 @@ public:
                 const unsigned int chunk_size{remaining_bytes > max_chunk_size ? max_chunk_size : static_cast<unsigned int>(remaining_bytes)};
                 unsigned int read_count;
                 const FRESULT read_result{f_read(&file_handle, memory.data() + read_bytes, chunk_size, &read_count)};
-                if (read_count != chunk_size)
+                current_offset += read_count;
+                if (read_result == FR_OK && read_count != chunk_size)
                 {
                     print("FileReader f_read read_count (%u) differs from chunk_size (%u)\n", read_count, chunk_size);
+                    return false;
                 }
-                current_offset += chunk_size;
                 if (read_result != FR_OK)
                 {
                     last_result = read_result;
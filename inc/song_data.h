@@ -1,7 +1,11 @@
 #pragma once
+#include <array>
 #include <cstdint>
+#include <limits>
 #include <optional>
+#include <span>
 #include <vector>
+#include "calibration.h"
 #include "leds.h"
 #include "sd.h"
 
@@ -9,6 +13,12 @@ namespace song_data
 {
 struct Note
 {
+    // Scroll speed as used while rendering: fixed-point with 16 fractional bits, clamped to [1/256, 16]
+    constexpr static std::uint32_t speed_fraction_bits{ 16 };
+    constexpr static std::uint32_t speed_one{ 1u << speed_fraction_bits };
+    constexpr static std::uint32_t min_fixed_speed{ speed_one >> 8 };
+    constexpr static std::uint32_t max_fixed_speed{ speed_one << 4 };
+
     enum Color : std::uint8_t {
         Red,
         Green,
@@ -22,51 +32,257 @@ struct Note
     } direction;
     std::uint32_t start_ms;
     std::uint32_t length_ms;
-    float speed{ 1.0f }; // TODO
+    float speed{ 1.0f }; // Multiplies how many pixels the note moves per ms; it still reaches the end of the ring at start_ms
     std::array<std::uint8_t, 2> padding; // Unused
 
-    [[nodiscard]] color get_pixel_color(bool bright = true) const;
+    [[nodiscard]] bool validate() const;
+    [[nodiscard]] std::uint32_t get_fixed_speed() const;
+    [[nodiscard]] packed_color get_pixel_color(bool bright = true) const;
+    [[nodiscard]] static packed_color get_pixel_color(Color note_color, bool bright);
 } __attribute__((packed));
 static_assert(sizeof(Note) == 16);
 
 using note_list = std::vector<Note>;
+
+// Notes as they are kept in RAM: one naturally aligned array per field, so scans only touch what they need.
+// Start positions are the fixed-point pixels of Song::note_time_to_pixel_position, which the start time can be
+// recovered from exactly, and holds are kept by their length in ms.
+class NoteTable
+{
+public:
+    constexpr static std::uint32_t position_fraction_bits{ 8 };
+    constexpr static std::size_t max_speed_classes{ 32 };
+
+    [[nodiscard]] std::size_t size() const { return start_positions.size(); }
+    [[nodiscard]] bool empty() const { return start_positions.empty(); }
+    void reserve(std::size_t count);
+    void clear();
+    // False if the note needs more distinct speeds than max_speed_classes, starts too late for 32 bits of position or
+    // holds for longer than 16 bits of ms
+    bool push_back(const Note& note, std::int64_t start_position);
+    void erase_front(std::size_t count);
+    void truncate(std::size_t count);
+    [[nodiscard]] bool is_sorted() const;
+    void stable_sort();
+
+    [[nodiscard]] std::span<const std::uint32_t> get_start_positions() const { return start_positions; }
+    [[nodiscard]] std::int64_t get_start_position(std::size_t index) const { return start_positions[index]; }
+    [[nodiscard]] std::uint32_t get_length_ms(std::size_t index) const { return length_ms[index]; }
+    [[nodiscard]] Note::Color get_color(std::size_t index) const { return static_cast<Note::Color>(attributes[index] & color_mask); }
+    [[nodiscard]] Note::Direction get_direction(std::size_t index) const
+    {
+        return static_cast<Note::Direction>((attributes[index] >> direction_shift) & 1);
+    }
+    [[nodiscard]] std::uint32_t get_speed(std::size_t index) const { return speed_classes[attributes[index] >> speed_class_shift]; }
+    // Heap bytes used per note, not counting spare capacity
+    constexpr static std::size_t bytes_per_note{ sizeof(std::uint32_t) + sizeof(std::uint16_t) + sizeof(std::uint8_t) };
+
+private:
+    // Color in bits 0-1, direction in bit 2 and the index into speed_classes in bits 3-7
+    constexpr static std::uint8_t color_mask{ 0b11 };
+    constexpr static std::uint8_t direction_shift{ 2 };
+    constexpr static std::uint8_t speed_class_shift{ 3 };
+    static_assert(max_speed_classes <= (0xffu >> speed_class_shift) + 1);
+
+    std::vector<std::uint32_t> start_positions;
+    std::vector<std::uint16_t> length_ms;
+    std::vector<std::uint8_t> attributes;
+    std::array<std::uint32_t, max_speed_classes> speed_classes{};
+    std::size_t speed_class_count{ 0 };
+
+    template <typename TFunction>
+    void for_each_array(TFunction&& function)
+    {
+        function(start_positions);
+        function(length_ms);
+        function(attributes);
+    }
+};
+
 struct Song 
 {
-    constexpr static std::uint16_t verison_major{ 1 };
+    constexpr static std::uint16_t verison_major{ 2 };
+    constexpr static std::uint16_t oldest_version_major{ 1 }; // Oldest format which still loads
+    // Pixel positions are fixed-point with this many fractional bits, so ms_per_pixel may be at most 1 << pixel_fraction_bits
+    constexpr static std::uint32_t pixel_fraction_bits{ NoteTable::position_fraction_bits };
+    // Streamed charts keep at most this many upcoming notes in RAM and top them up a batch at a time
+    constexpr static std::uint32_t streamed_note_capacity{ 512 };
+    constexpr static std::uint32_t stream_refill_batch{ 64 }; // Two sectors of notes
+    constexpr static std::uint32_t load_batch_note_count{ 1024 }; // Notes are converted to a NoteTable through a buffer this big
+    // Bytes of encoded notes read at once
+    constexpr static std::size_t load_read_buffer_size{ 4096 };
+    constexpr static std::size_t stream_read_buffer_size{ 512 };
 
     struct Header
     {
         char magic_note[4]; // Should always be "NOTE"
-        std::uint16_t version_major; // Should match song_data::Song::verison_major
+        std::uint16_t version_major; // Between song_data::Song::oldest_version_major and song_data::Song::verison_major
         std::uint16_t version_minor; // Indicates minor changes which should be backwards compatible
         std::uint32_t ms_per_pixel;
-        std::size_t note_count;
+        std::uint32_t note_count;
         std::array<char, 32> author;
         std::uint8_t difficulty; // 1-10
-        std::array<std::uint8_t, 31> padding; // Unused
+        // Version 2 onwards; these were padding, so they are 0 in version 1 files
+        std::uint32_t block_count; // Entries in the block index which follows the header
+        std::uint32_t note_data_size; // Bytes of encoded notes which follow the block index
+        std::uint32_t checksum; // CRC-32 of the block index and note data
+        // Version 2.1 onwards, 0 before: added to every note's start to line the chart up with the music
+        std::int16_t offset_ms;
+        std::array<std::uint8_t, 17> padding; // Unused
 
         bool validate() const;
+        // Bytes after the header which the notes and block index take up
+        [[nodiscard]] FSIZE_t get_body_size() const;
     } __attribute__((packed));
+    static_assert(sizeof(Header) == 80);
+
+    // Version 2 files index the notes by second, so the notes from any point in a song can be found with one lookup.
+    // Entry n points at the first note starting at or after n seconds.
+    struct BlockIndexEntry
+    {
+        constexpr static std::uint32_t block_ms{ 1000 };
+
+        std::uint32_t first_note;
+        std::uint32_t data_offset; // From the start of the note data
+        std::uint32_t previous_start_ms; // The note's start is delta coded from this; 0 for the first note
+    };
+    static_assert(sizeof(BlockIndexEntry) == 12);
+
+    // Reads the notes after the header of a .note file, decoding them for version 2.
+    // Each version 2 note is an attribute byte (color in bits 0-1, direction in bit 2, bit 3 set if a length follows,
+    // bit 4 set if a speed follows), the start as an unsigned LEB128 delta from the previous note's start,
+    // then the length as an unsigned LEB128 and the speed as a float if their bits are set.
+    class NoteReader
+    {
+    public:
+        NoteReader(SDCard::FileReader file, const Header& header, std::size_t buffer_size);
+
+        // Fills notes in order; false on a read error, corrupt data or a checksum mismatch at the end of the file
+        bool read(std::span<Note> notes);
+        // Reads the whole body to check the CRC up front, then rewinds; always true for version 1
+        bool verify_checksum();
+        // Moves to the first note starting at or after the start of time_ms' block; version 2 only.
+        // The checksum is not checked after seeking.
+        std::optional<std::uint32_t> seek(std::uint32_t time_ms);
+
+    private:
+        constexpr static std::size_t max_encoded_note_size{ 1 + 5 + 5 + sizeof(float) };
+
+        bool decode(Note& note);
+        bool fill_buffer();
+        bool read_varint(std::uint32_t& out_value);
+        void rewind();
+
+        SDCard::FileReader file;
+        std::uint16_t version_major;
+        std::uint32_t block_count;
+        std::uint32_t note_data_size;
+        std::uint32_t expected_checksum;
+        FSIZE_t body_remaining{ 0 }; // Bytes not pulled into buffer yet
+        FSIZE_t index_bytes_to_skip{ 0 };
+        std::uint32_t checksum{ 0 };
+        bool checking{ true };
+        std::uint32_t previous_start_ms{ 0 };
+        std::vector<std::uint8_t> buffer;
+        std::size_t buffer_position{ 0 };
+        std::size_t buffer_size{ 0 };
+    };
     Song() = default;
     Song(Song&&) = default;
     Song(const Song&) = default;
     Song(const Header& header)
-        : header{ header }, notes{header.note_count}
-    {}
+    {
+        set_header(header);
+        notes.reserve(header.note_count);
+    }
     Song& operator=(Song&&) = default;
     Song& operator=(const Song&) = default;
 
+    // Range of notes which may light a pixel at time_ms; kept up to date by update_visible_window
+    struct VisibleWindow
+    {
+        std::size_t tail{ 0 };
+        std::size_t head{ 0 };
+        std::uint32_t time_ms{ 0 };
+    };
+
+    // A note's start and end as fixed-point pixels, converted at load so rendering needs no division.
+    // Positions are at normal speed; the note's fixed-point speed scales distances from them with a multiply.
+    struct PixelNote
+    {
+        std::int64_t start;
+        std::int64_t end;
+        std::uint32_t speed;
+        Note::Color note_color;
+        Note::Direction direction;
+    };
+
+    // Where a note is on the ring: the pixel index of its head and the length of its hold in whole pixels
+    struct NotePlacement
+    {
+        std::int64_t start_index;
+        std::int64_t length_leds;
+        std::int64_t head_position; // Where the head is between LEDs, in LEDs with pixel_fraction_bits of fraction
+        bool upcoming; // Further away than the length of the ring, so not drawn yet
+
+        [[nodiscard]] bool is_expired(Note::Direction direction) const;
+    };
+
     Header header;
-    note_list notes;
+    NoteTable notes; // Sorted by start; add them with add_note
     std::uint32_t current_time_ms{ 0 };
+    std::uint32_t lookahead_ms{ 0 }; // No note starting later than this after current_time_ms is on the ring yet
+    std::uint32_t trailing_ms{ 0 }; // Every note starting longer than this before current_time_ms has left the ring
+    mutable VisibleWindow visible_window;
+    std::optional<NoteReader> note_stream; // Only set for streamed songs
+    note_list stream_buffer; // Notes are read into this before being added
+    std::uint32_t streamed_notes_remaining{ 0 };
+    // Notes of the chart before notes[0], which streaming has dropped or a seek skipped; the chart's nth note is
+    // notes[n - dropped_note_count]
+    std::size_t dropped_note_count{ 0 };
+    // Added to each note's start, so notes line up with the audio timeline as it is heard, seen and pressed: the render
+    // offset to its position as it is added, and the judge offset to its start time as it is read back
+    std::int32_t render_offset_ms{ 0 };
+    std::int32_t judge_offset_ms{ 0 };
+    // Pixel positions per ms with Note::speed_fraction_bits more fraction than them, so holds convert with a multiply
+    std::uint32_t position_per_ms{ 0 };
+
+    // Charts with more than max_loaded_notes notes are streamed; see refill_note_stream
+    static std::optional<Song> load_from_note_file(
+        SDCard::FileReader file,
+        std::uint32_t max_loaded_notes = std::numeric_limits<std::uint32_t>::max(),
+        const LatencyOffsets& offsets = {}
+    );
+    // Drops notes which have left the ring and come before the chart's keep_from_note, then reads more from the file
+    bool refill_note_stream(std::size_t keep_from_note = std::numeric_limits<std::size_t>::max());
+    // Moves playback to time_ms. Streamed songs can only go backwards with a version 2 file, whose ring is refilled
+    // from the block index; holds longer than any read so far which started before the seek are missed.
+    bool seek(std::uint32_t time_ms);
+    [[nodiscard]] bool is_streamed() const { return note_stream.has_value(); }
 
-    static std::optional<Song> load_from_note_file(SDCard::FileReader file);
+    // Combines the latencies with the header's offset_ms; only affects notes added afterwards
+    void set_offsets(const LatencyOffsets& offsets);
+    // Appends a note and widens lookahead_ms and trailing_ms to cover it; false if it can't be stored
+    bool add_note(const Note& note);
+    // Restores the order of notes after adding them out of order
+    void sort_notes();
+    [[nodiscard]] PixelNote get_pixel_note(std::size_t index) const;
+    // When the note is to be pressed, recovered from its start position and moved from the render to the judge offset
+    [[nodiscard]] std::uint32_t get_note_start_ms(std::size_t index) const;
+    [[nodiscard]] std::uint32_t get_note_length_ms(std::size_t index) const { return notes.get_length_ms(index); }
+    const VisibleWindow& update_visible_window() const;
+    [[nodiscard]] std::array<packed_color, visible_led_count> render_leds() const;
+    [[nodiscard]] static NotePlacement place_note(const PixelNote& note, std::int64_t current_position);
 
-    [[nodiscard]] std::array<color, visible_led_count> render_leds() const;
+    [[nodiscard]] std::int64_t note_length_to_pixel_count(std::uint32_t time_ms, std::uint32_t speed = Note::speed_one) const;
+    [[nodiscard]] std::int64_t pixel_count_to_note_length(std::uint32_t count, std::uint32_t speed = Note::speed_one) const;
+    [[nodiscard]] std::int64_t note_time_to_pixel_index(std::uint32_t time_ms, Note::Direction direction, std::uint32_t speed = Note::speed_one) const;
+    [[nodiscard]] std::int64_t pixel_index_to_note_time(std::size_t index, Note::Direction direction, std::uint32_t speed = Note::speed_one) const;
+    [[nodiscard]] std::int64_t note_time_to_pixel_position(std::uint32_t time_ms) const;
 
-    [[nodiscard]] std::int64_t note_length_to_pixel_count(std::uint32_t time_ms) const;
-    [[nodiscard]] std::int64_t pixel_count_to_note_length(std::uint32_t count) const;
-    [[nodiscard]] std::int64_t note_time_to_pixel_index(std::uint32_t time_ms, Note::Direction direction) const;
-    [[nodiscard]] std::int64_t pixel_index_to_note_time(std::size_t index, Note::Direction direction) const;
+private:
+    void set_header(const Header& new_header);
+    bool read_notes(NoteReader& reader, std::size_t count);
+    bool read_streamed_notes();
 };
 }
@@ -0,0 +1,64 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+
+// Fixed size queue between one producer and one consumer, such as an interrupt handler and the main loop.
+// Each side only writes its own index, so neither needs to disable interrupts. Capacity must be a power of two.
+template <typename T, std::size_t capacity>
+class spsc_queue
+{
+    static_assert(capacity != 0 && (capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+    // The indices are only ever loaded and stored, never read-modify-written, which a single core does atomically for
+    // an aligned word. Cortex-M0+ has no compare-and-swap, so is_always_lock_free is false there and can't be asserted.
+    static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t)
+        && alignof(std::atomic<std::uint32_t>) == alignof(std::uint32_t), "indices must be plain aligned words");
+
+public:
+    // Returns false, dropping the item, when full
+    bool push(const T& item)
+    {
+        const std::uint32_t tail{ tail_index.load(std::memory_order_relaxed) };
+        if (tail - head_index.load(std::memory_order_acquire) == capacity)
+        {
+            return false;
+        }
+        items[tail % capacity] = item;
+        tail_index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    [[nodiscard]] std::optional<T> pop()
+    {
+        const std::uint32_t head{ head_index.load(std::memory_order_relaxed) };
+        if (head == tail_index.load(std::memory_order_acquire))
+        {
+            return std::nullopt;
+        }
+        const T item{ items[head % capacity] };
+        head_index.store(head + 1, std::memory_order_release);
+        return item;
+    }
+
+    // Only valid from the consumer
+    [[nodiscard]] const T* peek() const
+    {
+        const std::uint32_t head{ head_index.load(std::memory_order_relaxed) };
+        if (head == tail_index.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        return &items[head % capacity];
+    }
+
+    [[nodiscard]] bool empty() const
+    {
+        return head_index.load(std::memory_order_acquire) == tail_index.load(std::memory_order_acquire);
+    }
+
+private:
+    std::array<T, capacity> items{};
+    std::atomic<std::uint32_t> head_index{ 0 };
+    std::atomic<std::uint32_t> tail_index{ 0 };
+};
@@ -1,8 +0,0 @@
-#pragma once
-class Machine;
-
-class State
-{
-public:
-    virtual void operator()(Machine& machine) = 0;
-};
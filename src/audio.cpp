@@ -2,6 +2,8 @@
 #include "sd.h"
 #include <cstdint>
 #include <array>
+#include <algorithm>
+#include <atomic>
 #include "pico/stdlib.h"   // stdlib
 #include "hardware/irq.h"  // interrupts
 #include "hardware/pwm.h"  // pwm
@@ -11,29 +13,74 @@
 static std::array<Audio::buffer, Audio::total_buffer_count> buffers{ { { 0 }, { 0 } } };
 static std::size_t empty_buffer_count{ Audio::total_buffer_count };
 static std::size_t active_read_buffer{ 0 };
-static std::size_t wav_position{ 0 };
+// Written only by the PWM interrupt once streaming starts, so plain loads and stores are enough
+static std::atomic<std::uint32_t> wav_position{ 0 };
+static std::atomic<bool> playing{ false };
+static std::uint32_t click_period_samples{ 0 }; // Non-zero while a click track plays
+// The sample and time_us_32 at the last buffer boundary, published under a sequence count which is odd while
+// they change. Positions between boundaries are interpolated from the time since.
+static std::atomic<std::uint32_t> boundary_sequence{ 0 };
+static std::atomic<std::uint32_t> boundary_sample{ 0 };
+static std::atomic<std::uint32_t> boundary_time_us{ 0 };
 static Audio::WAVHeader streaming_file_header;
 static std::optional<SDCard::FileReader> streaming_file;
 
 namespace Audio
 {
+static void publish_boundary(std::uint32_t sample)
+{
+    const std::uint32_t sequence{ boundary_sequence.load(std::memory_order_relaxed) };
+    boundary_sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_release);
+    boundary_sample.store(sample, std::memory_order_relaxed);
+    boundary_time_us.store(time_us_32(), std::memory_order_relaxed);
+    boundary_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+static constexpr std::uint64_t sample_to_position(std::uint32_t sample)
+{
+    return (std::uint64_t{ sample } * 1'000'000 << position_fraction_bits) / sample_rate;
+}
+
+// A 2.75kHz square wave for 2ms
+static std::uint8_t get_click_level(std::uint32_t position)
+{
+    constexpr std::uint32_t click_samples{ Audio::sample_rate / 500 };
+    constexpr std::uint32_t half_wave_samples{ 4 };
+    const std::uint32_t offset{ position % click_period_samples };
+    return offset < click_samples && (offset / half_wave_samples) % 2 == 0 ? 0xff : 0;
+}
+
 static void pwm_interrupt_handler()
 {
     pwm_clear_irq(pwm_gpio_to_slice_num(AUDIO_PIN));
-    if (!streaming_file.has_value() || wav_position > streaming_file_header.data_size)
+    std::uint32_t position{ wav_position.load(std::memory_order_relaxed) };
+    if (click_period_samples != 0)
+    {
+        pwm_set_gpio_level(AUDIO_PIN, get_click_level(position));
+        ++position;
+        wav_position.store(position, std::memory_order_relaxed);
+        if (position % Audio::audio_buffer_size == 0)
+        {
+            publish_boundary(position);
+        }
+        return;
+    }
+    if (!streaming_file.has_value() || position > streaming_file_header.data_size)
     {
         stop_streaming_wave();
-        pwm_set_gpio_level(AUDIO_PIN, 0);
         return;
     }
     const Audio::buffer& active_buffer{ buffers[active_read_buffer] };
     // set pwm level
-    pwm_set_gpio_level(AUDIO_PIN, active_buffer[wav_position % active_buffer.size()]);
-    ++wav_position;
-    if (wav_position % active_buffer.size() == 0)
+    pwm_set_gpio_level(AUDIO_PIN, active_buffer[position % active_buffer.size()]);
+    ++position;
+    wav_position.store(position, std::memory_order_relaxed);
+    if (position % active_buffer.size() == 0)
     {
         active_read_buffer ^= 1;
         ++empty_buffer_count;
+        publish_boundary(position);
     }
 }
 
@@ -130,7 +177,8 @@ bool start_streaming_wave(SDCard::FileReader wave_file)
         irq_set_enabled(PWM_IRQ_WRAP, false);
         return false;
     }
-    wav_position = 0;
+    wav_position.store(0, std::memory_order_relaxed);
+    publish_boundary(0);
     buffers[0].fill(0);
     buffers[1].fill(0);
     streaming_file = wave_file;
@@ -139,6 +187,7 @@ bool start_streaming_wave(SDCard::FileReader wave_file)
     active_read_buffer ^= 1;
     stream_wave_to_inactive_buffer();
     active_read_buffer ^= 1;
+    playing.store(true, std::memory_order_release);
     irq_set_enabled(PWM_IRQ_WRAP, true);
     return true;
 }
@@ -150,7 +199,7 @@ void stream_wave_to_inactive_buffer()
         return;
     }
     Audio::buffer& inactive_buffer{ buffers[active_read_buffer ^ 1] };
-    if (wav_position >= streaming_file_header.data_size)
+    if (wav_position.load(std::memory_order_relaxed) >= streaming_file_header.data_size)
     {
         stop_streaming_wave();
         return;
@@ -161,7 +210,46 @@ void stream_wave_to_inactive_buffer()
 
 void stop_streaming_wave()
 {
+    playing.store(false, std::memory_order_release);
     streaming_file = std::nullopt;
     irq_set_enabled(PWM_IRQ_WRAP, false);
+    click_period_samples = 0;
+    pwm_set_gpio_level(AUDIO_PIN, 0);
+}
+
+void start_click_track(std::uint32_t period_samples)
+{
+    stop_streaming_wave();
+    wav_position.store(0, std::memory_order_relaxed);
+    publish_boundary(0);
+    click_period_samples = period_samples;
+    playing.store(true, std::memory_order_release);
+    irq_set_enabled(PWM_IRQ_WRAP, true);
+}
+
+std::optional<std::uint64_t> get_playback_position()
+{
+    if (!playing.load(std::memory_order_acquire))
+    {
+        return std::nullopt;
+    }
+    std::uint32_t sequence;
+    std::uint32_t sample;
+    std::uint32_t time_us;
+    std::uint32_t current_sample;
+    do
+    {
+        sequence = boundary_sequence.load(std::memory_order_acquire);
+        sample = boundary_sample.load(std::memory_order_relaxed);
+        time_us = boundary_time_us.load(std::memory_order_relaxed);
+        current_sample = wav_position.load(std::memory_order_relaxed);
+        std::atomic_signal_fence(std::memory_order_acquire);
+    } while ((sequence & 1) != 0 || sequence != boundary_sequence.load(std::memory_order_relaxed));
+
+    // Interpolating keeps the position smooth between samples, while the sample count stops it drifting from them
+    const std::uint64_t interpolated{
+        sample_to_position(sample) + (std::uint64_t{ time_us_32() - time_us } << position_fraction_bits)
+    };
+    return std::clamp(interpolated, sample_to_position(current_sample), sample_to_position(current_sample + 1) - 1);
 }
 }
@@ -0,0 +1,33 @@
+#include "calibration.h"
+#include <cstdio>
+#include <string>
+
+std::optional<LatencyOffsets> LatencyOffsets::load(const SDCard& sd)
+{
+    std::string contents;
+    if (!sd.read_text_file(file_path, contents))
+    {
+        return std::nullopt;
+    }
+    LatencyOffsets offsets;
+    int audio{ 0 };
+    int visual{ 0 };
+    int input{ 0 };
+    if (std::sscanf(contents.c_str(), " audio_us %d visual_us %d input_us %d", &audio, &visual, &input) != 3)
+    {
+        print("LatencyOffsets failed to parse %s\n", file_path);
+        return std::nullopt;
+    }
+    offsets.audio_us = audio;
+    offsets.visual_us = visual;
+    offsets.input_us = input;
+    return offsets;
+}
+
+bool LatencyOffsets::save(SDCard& sd) const
+{
+    char contents[96];
+    const int length{ std::snprintf(contents, sizeof(contents), "audio_us %d\nvisual_us %d\ninput_us %d\n",
+        static_cast<int>(audio_us), static_cast<int>(visual_us), static_cast<int>(input_us)) };
+    return sd.write_text_file(file_path, { contents, static_cast<std::size_t>(length) });
+}
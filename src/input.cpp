@@ -1,46 +1,114 @@
 #include "input.h"
+#include <array>
 #include "pico/stdlib.h"   // stdlib
+#include "hardware/sync.h"
 
-Button::Button(std::uint32_t gpio_pin)
-    : gpio_pin{ gpio_pin }
+namespace
+{
+constexpr std::uint32_t edge_events{ GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE };
+
+// The GPIO callback is shared by every pin, so it finds the button from here
+std::array<Button*, NUM_BANK0_GPIOS> buttons_by_pin{};
+}
+
+Button::Button(std::uint32_t gpio_pin, std::uint32_t debounce_us)
+    : gpio_pin{ gpio_pin }, debounce_us{ debounce_us }
 {
     gpio_set_dir(gpio_pin, GPIO_IN);
     gpio_set_pulls(gpio_pin, true, false);
+
+    // A button held at power on counts as pressed then
+    if (!gpio_get(gpio_pin))
+    {
+        accept_edge(time_us_64(), true);
+    }
+
+    buttons_by_pin[gpio_pin] = this;
+    gpio_set_irq_enabled_with_callback(gpio_pin, edge_events, true, &Button::on_gpio_edge);
+}
+
+Button::~Button()
+{
+    gpio_set_irq_enabled(gpio_pin, edge_events, false);
+    buttons_by_pin[gpio_pin] = nullptr;
 }
 
 void Button::update()
 {
-    const bool is_pressed{ !gpio_get(gpio_pin) };
+    // Edges ignored while debouncing may have left the level changed with no edge to come, in which case the last
+    // of them is when it changed. With none ignored, the edge's interrupt is pending behind this, so it was just now.
+    const std::uint32_t interrupts{ save_and_disable_interrupts() };
+    const std::uint64_t now_us{ time_us_64() };
+    if (now_us >= debounced_at_us && !gpio_get(gpio_pin) != is_pressed)
+    {
+        accept_edge(ignored_at_us.value_or(now_us), !is_pressed);
+    }
+    restore_interrupts(interrupts);
 
+    const Event* event{ events.peek() };
     switch (last_state)
     {
     case State::Uninitialized:
-        if (is_pressed)
-        {
-            last_state = State::Pressed;
-        }
-        else
-        {
-            last_state = State::Open;
-        }
-        break;
     case State::Released:
         last_state = State::Open;
         [[fallthrough]];
     case State::Open:
-        if (is_pressed)
+        if (event != nullptr && event->is_press)
         {
             last_state = State::Pressed;
+            changed_at_us = event->time_us;
         }
         break;
     case State::Pressed:
         last_state = State::Held;
         [[fallthrough]];
     case State::Held:
-        if (!is_pressed)
+        if (event != nullptr && !event->is_press)
         {
             last_state = State::Released;
+            changed_at_us = event->time_us;
         }
         break;
     }
+    if (event != nullptr)
+    {
+        // Edges alternate, so the event is always the one just handled
+        static_cast<void>(events.pop());
+    }
+}
+
+void Button::on_gpio_edge(uint gpio, std::uint32_t edges)
+{
+    Button* button{ buttons_by_pin[gpio] };
+    if (button == nullptr)
+    {
+        return;
+    }
+    // Buttons pull the pin low. If both edges are pending the pin bounced, so take its level now.
+    const bool is_press{ edges == GPIO_IRQ_EDGE_FALL || (edges != GPIO_IRQ_EDGE_RISE && !gpio_get(gpio)) };
+    button->record_edge(time_us_64(), is_press);
+}
+
+void Button::record_edge(std::uint64_t time_us, bool is_press)
+{
+    if (is_press == is_pressed)
+    {
+        return;
+    }
+    if (time_us < debounced_at_us)
+    {
+        ignored_at_us = time_us;
+        return;
+    }
+    accept_edge(time_us, is_press);
+}
+
+void Button::accept_edge(std::uint64_t time_us, bool is_press)
+{
+    if (events.push({ time_us, is_press }))
+    {
+        is_pressed = is_press;
+        debounced_at_us = time_us + debounce_us;
+        ignored_at_us.reset();
+    }
 }
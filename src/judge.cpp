@@ -0,0 +1,121 @@
+#include "judge.h"
+#include <algorithm>
+
+namespace song_data
+{
+    Judge::Judge(std::uint8_t difficulty)
+        : windows{ difficulty_windows[std::clamp<std::size_t>(difficulty, 1, difficulty_windows.size()) - 1] }
+    {
+    }
+
+    std::uint32_t Judge::press(const Song& song, std::size_t lane_index, std::int64_t time_us)
+    {
+        std::uint32_t points{ update_lane(song, lane_index, time_us) };
+        Lane& lane{ lanes[lane_index] };
+        if (lane.hold_end_us.has_value())
+        {
+            return points;
+        }
+        // After update_lane, any note left is at most good_us late, so only an early press can miss it
+        const std::optional<std::size_t> index{ find_next_note(song, lane, lane_index) };
+        if (!index.has_value())
+        {
+            return points;
+        }
+        const std::int64_t start_us{ std::int64_t{ song.get_note_start_ms(*index) } * 1000 };
+        if (start_us - time_us > windows.good_us)
+        {
+            return points;
+        }
+        points += score(grade_offset(time_us - start_us));
+        if (const std::uint32_t length_ms{ song.get_note_length_ms(*index) }; length_ms != 0)
+        {
+            lane.hold_end_us = start_us + std::int64_t{ length_ms } * 1000;
+        }
+        ++lane.cursor;
+        return points;
+    }
+
+    std::uint32_t Judge::release(const Song& song, std::size_t lane_index, std::int64_t time_us)
+    {
+        const std::uint32_t points{ update_lane(song, lane_index, time_us) };
+        Lane& lane{ lanes[lane_index] };
+        if (!lane.hold_end_us.has_value())
+        {
+            return points;
+        }
+        // Letting go after the end is handled by update_lane, so this is either close to the end or too early
+        const std::int64_t early_us{ *lane.hold_end_us - time_us };
+        lane.hold_end_us.reset();
+        return points + score(early_us > windows.good_us ? Grade::Miss : grade_offset(early_us));
+    }
+
+    std::uint32_t Judge::update(const Song& song, std::int64_t time_us)
+    {
+        std::uint32_t points{ 0 };
+        for (std::size_t lane_index{ 0 }; lane_index < lanes.size(); ++lane_index)
+        {
+            points += update_lane(song, lane_index, time_us);
+        }
+        return points;
+    }
+
+    std::uint32_t Judge::update_lane(const Song& song, std::size_t lane_index, std::int64_t time_us)
+    {
+        std::uint32_t points{ 0 };
+        Lane& lane{ lanes[lane_index] };
+        if (lane.hold_end_us.has_value() && time_us >= *lane.hold_end_us)
+        {
+            lane.hold_end_us.reset();
+            points += score(Grade::Perfect);
+        }
+        // The next note can't be pressed while a hold is held, so its window closing counts as a miss too
+        while (const std::optional<std::size_t> index{ find_next_note(song, lane, lane_index) })
+        {
+            if (time_us - std::int64_t{ song.get_note_start_ms(*index) } * 1000 <= windows.good_us)
+            {
+                break;
+            }
+            score(Grade::Miss);
+            ++lane.cursor;
+        }
+        return points;
+    }
+
+    std::size_t Judge::get_first_unjudged_note() const
+    {
+        return std::min_element(lanes.begin(), lanes.end(), [](const Lane& lhs, const Lane& rhs) { return lhs.cursor < rhs.cursor; })->cursor;
+    }
+
+    std::optional<std::size_t> Judge::find_next_note(const Song& song, Lane& lane, std::size_t lane_index)
+    {
+        // Streaming keeps every note from get_first_unjudged_note on, so only a seek can have skipped the cursor's
+        lane.cursor = std::max(lane.cursor, song.dropped_note_count);
+        for (std::size_t index{ lane.cursor - song.dropped_note_count }; index < song.notes.size(); ++index, ++lane.cursor)
+        {
+            if (get_lane(song.notes.get_color(index), song.notes.get_direction(index)) == lane_index)
+            {
+                return index;
+            }
+        }
+        return std::nullopt;
+    }
+
+    Judge::Grade Judge::grade_offset(std::int64_t offset_us) const
+    {
+        const std::uint64_t distance_us{ static_cast<std::uint64_t>(offset_us < 0 ? -offset_us : offset_us) };
+        if (distance_us <= windows.perfect_us)
+        {
+            return Grade::Perfect;
+        }
+        return distance_us <= windows.good_us ? Grade::Good : Grade::Miss;
+    }
+
+    std::uint32_t Judge::score(Grade grade)
+    {
+        ++stats.grades[static_cast<std::size_t>(grade)];
+        stats.combo = grade == Grade::Miss ? 0 : stats.combo + 1;
+        stats.max_combo = std::max(stats.max_combo, stats.combo);
+        return grade_points[static_cast<std::size_t>(grade)];
+    }
+}
@@ -1,5 +1,10 @@
 #include "lcd.h"
+#include <algorithm>
+#include <bit>
 #include <stdio.h>
+#include "hardware/dma.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
 
 static bool reserved_addr(uint8_t addr) {
     return (addr & 0x78) == 0 || (addr & 0x78) == 0x78;
@@ -38,28 +43,56 @@ void scan_i2c_bus()
     printf("Done.\n");
 }
 
+static_assert(I2C_LCD::cell_count <= 32, "Dirty cells are tracked in a 32-bit mask");
+
+static I2C_LCD* alarm_owner{ nullptr };
+
 I2C_LCD::I2C_LCD()
 {
-    i2c_init(LCD_I2C_CHANNEL, 100'000);
+    screen.fill(' ');
+    shown.fill(' ');
+
+    i2c_init(LCD_I2C_CHANNEL, LCD_I2C_BAUDRATE);
     gpio_set_function(LCD_SDA_PIN, GPIO_FUNC_I2C);
     gpio_set_function(LCD_SCL_PIN, GPIO_FUNC_I2C);
     gpio_pull_up(LCD_SDA_PIN);
     gpio_pull_up(LCD_SCL_PIN);
 
-    send_command(static_cast<Command>(0x03));
-    send_command(static_cast<Command>(0x03));
-    send_command(static_cast<Command>(0x03));
+    // The target address can only be changed while the controller is disabled
+    i2c_hw_t* i2c_hw{ i2c_get_hw(LCD_I2C_CHANNEL) };
+    i2c_hw->enable = 0;
+    i2c_hw->tar = LCD_I2C_ADDR;
+    i2c_hw->enable = 1;
+
+    dma_channel = static_cast<std::uint32_t>(dma_claim_unused_channel(true));
+    dma_channel_config config{ dma_channel_get_default_config(dma_channel) };
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, i2c_get_dreq(LCD_I2C_CHANNEL, true));
+    dma_channel_configure(dma_channel, &config, &i2c_hw->data_cmd, nullptr, dma_words.size(), false);
+
+    alarm_owner = this;
+    alarm = static_cast<std::uint32_t>(hardware_alarm_claim_unused(true));
+    hardware_alarm_set_callback(alarm, &I2C_LCD::on_alarm);
+
+    send_byte(0x03, SendMode::Command, first_init_us);
+    send_byte(0x03, SendMode::Command, second_init_us);
+    send_byte(0x03, SendMode::Command, execution_us);
     send_command(Command::ReturnHome);
 
     send_command(Command::EntryModeSet, EntryModeFlag::EntryLeft);
     send_command(Command::FunctionSet, FunctionSetFlag::TwoLine);
     send_command(Command::DisplayControl, DisplayFlag::DisplayOn);
+    // The only ClearDisplay, since the contents are unknown at power on
+    send_command(Command::ClearDisplay);
     display("0123456789");
 }
 
 void I2C_LCD::send_character(char character)
 {
-    send_byte(static_cast<std::uint8_t>(character), SendMode::Character);
+    write_cell(character);
+    flush();
 }
 
 void I2C_LCD::send_command(Command command)
@@ -72,57 +105,174 @@ void I2C_LCD::send_command(Command command)
 
 void I2C_LCD::clear()
 {
-    send_command(Command::ClearDisplay);
-    move_cursor(0, 0);
+    display({});
 }
 
 void I2C_LCD::display(std::string_view str, bool clear_first /* = true */)
 {
     if (clear_first)
     {
-        clear();
+        move_cursor(0, 0);
+        for (std::size_t cell{ 0 }; cell < cell_count; ++cell)
+        {
+            write_cell(' ');
+        }
+        move_cursor(0, 0);
     }
     for (char character : str)
     {
-        send_character(character);
+        write_cell(character);
     }
+    flush();
 }
 
 void I2C_LCD::move_cursor(std::uint8_t line, std::uint8_t position)
 {
-    send_command(static_cast<Command>((line == 0 ? 0x80 : 0xC0) + position));
+    cursor_cell = line * line_length + position;
+}
+
+void I2C_LCD::update()
+{
+    flush();
+}
+
+bool I2C_LCD::is_idle() const
+{
+    return dirty_cells == 0 && !sending && queue_head == queue_tail;
+}
+
+void I2C_LCD::write_cell(char character)
+{
+    if (cursor_cell >= cell_count)
+    {
+        return;
+    }
+    screen[cursor_cell] = character;
+    const std::uint32_t bit{ 1u << cursor_cell };
+    dirty_cells = character != shown[cursor_cell] ? dirty_cells | bit : dirty_cells & ~bit;
+    ++cursor_cell;
+}
+
+void I2C_LCD::flush()
+{
+    // Cells which don't fit stay dirty for the next update
+    while (dirty_cells != 0 && get_free_slots() >= 2)
+    {
+        const std::size_t cell{ static_cast<std::size_t>(std::countr_zero(dirty_cells)) };
+        const std::uint8_t cell_address{ get_cell_address(cell) };
+        if (address != cell_address)
+        {
+            const std::uint8_t command{ static_cast<std::uint8_t>(static_cast<std::uint8_t>(Command::SetDDRAMAddr) | cell_address) };
+            post(command, SendMode::Command, get_execution_us(command, SendMode::Command));
+        }
+        const std::uint8_t character{ static_cast<std::uint8_t>(screen[cell]) };
+        post(character, SendMode::Character, get_execution_us(character, SendMode::Character));
+        shown[cell] = screen[cell];
+        dirty_cells &= dirty_cells - 1;
+    }
+}
+
+void I2C_LCD::track_command(std::uint8_t command)
+{
+    if (command & static_cast<std::uint8_t>(Command::SetDDRAMAddr))
+    {
+        address = command & 0x7f;
+    }
+    else if (command == static_cast<std::uint8_t>(Command::ClearDisplay))
+    {
+        address = 0;
+        shown.fill(' ');
+        dirty_cells = 0;
+        for (std::size_t cell{ 0 }; cell < cell_count; ++cell)
+        {
+            dirty_cells |= screen[cell] != ' ' ? 1u << cell : 0;
+        }
+    }
+    else if ((command & ~1u) == static_cast<std::uint8_t>(Command::ReturnHome))
+    {
+        address = 0;
+    }
+    else if (command & (static_cast<std::uint8_t>(Command::CursorShift) | static_cast<std::uint8_t>(Command::SetCGRAMAddr)))
+    {
+        address = unknown_address;
+    }
+}
+
+void I2C_LCD::send_byte(std::uint8_t byte, SendMode mode, std::uint32_t wait_us)
+{
+    while (get_free_slots() == 0)
+    {
+        sleep_us(transaction_us);
+    }
+    post(byte, mode, wait_us);
+}
+
+void I2C_LCD::post(std::uint8_t byte, SendMode mode, std::uint32_t wait_us)
+{
+    const std::uint32_t interrupts{ save_and_disable_interrupts() };
+    queue[queue_tail % queue.size()] = byte | (static_cast<std::uint32_t>(mode) << 8) | (std::min<std::uint32_t>(wait_us, 0xffff) << 16);
+    queue_tail = queue_tail + 1;
+    if (!sending)
+    {
+        sending = true;
+        if (hardware_alarm_set_target(alarm, from_us_since_boot(ready_at_us)))
+        {
+            send_next();
+        }
+    }
+    restore_interrupts(interrupts);
+
+    if (mode == SendMode::Command)
+    {
+        track_command(byte);
+    }
+    else if (address != unknown_address)
+    {
+        ++address;
+    }
+}
+
+std::size_t I2C_LCD::get_free_slots() const
+{
+    return queue.size() - (queue_tail - queue_head);
 }
 
-void I2C_LCD::toggle_enable(std::uint8_t val)
+void I2C_LCD::send_next()
 {
-    constexpr static std::uint32_t delay_us{ 600u };
     constexpr static std::uint8_t lcd_enable_bit{ 1 << 2 };
-    sleep_us(delay_us);
-    i2c_write_byte(val | lcd_enable_bit);
-    sleep_us(delay_us);
-    i2c_write_byte(val & ~lcd_enable_bit);
-    sleep_us(delay_us);
-}
-
-void I2C_LCD::send_byte(std::uint8_t byte, SendMode mode)
-{
-    const std::uint8_t high{
-        static_cast<std::uint8_t>(
-            static_cast<std::uint8_t>(mode)
-            | (byte & 0xF0)
-            | static_cast<std::uint8_t>(BacklightFlag::BacklightOn)
-        )
-    };
-    const std::uint8_t low{
-        static_cast<std::uint8_t>(
-            static_cast<std::uint8_t>(mode)
-            | ((byte << 4) & 0xF0)
-            | static_cast<std::uint8_t>(BacklightFlag::BacklightOn)
-        )
-    };
-
-    i2c_write_byte(high);
-    toggle_enable(high);
-    i2c_write_byte(low);
-    toggle_enable(low);
+    // An alarm which is already due when set has to be run by hand, so keep going until one is set for the future
+    do
+    {
+        if (queue_head == queue_tail)
+        {
+            sending = false;
+            return;
+        }
+        const std::uint32_t entry{ queue[queue_head % queue.size()] };
+        queue_head = queue_head + 1;
+        const std::uint8_t byte{ static_cast<std::uint8_t>(entry) };
+        const SendMode mode{ static_cast<SendMode>((entry >> 8) & 0xff) };
+        const std::uint32_t wait_us{ entry >> 16 };
+
+        const std::uint8_t flags{ static_cast<std::uint8_t>(
+            static_cast<std::uint8_t>(mode) | static_cast<std::uint8_t>(BacklightFlag::BacklightOn)
+        ) };
+        const std::uint8_t high{ static_cast<std::uint8_t>(flags | (byte & 0xF0)) };
+        const std::uint8_t low{ static_cast<std::uint8_t>(flags | ((byte << 4) & 0xF0)) };
+        // Each nibble is latched as enable falls. A byte on the bus takes over 20us, far longer than the enable pulse
+        // and setup times the datasheet asks for, so no waits are needed within the sequence.
+        dma_words = {
+            std::uint32_t{ static_cast<std::uint8_t>(high | lcd_enable_bit) }, high,
+            std::uint32_t{ static_cast<std::uint8_t>(low | lcd_enable_bit) }, low | I2C_IC_DATA_CMD_STOP_BITS,
+        };
+        dma_channel_transfer_from_buffer_now(dma_channel, dma_words.data(), dma_words.size());
+
+        // The next byte's first nibble latches partway through its transaction, so it can start a little early
+        ready_at_us = time_us_64() + transaction_us + wait_us - std::min(wait_us, latch_delay_us);
+    } while (hardware_alarm_set_target(alarm, from_us_since_boot(ready_at_us)));
+}
+
+void I2C_LCD::on_alarm([[maybe_unused]] uint alarm_num)
+{
+    alarm_owner->send_next();
 }
@@ -1,109 +1,216 @@
 #include "leds.h"
+#include "led_effects.h"
 #include "pico/stdlib.h"   // stdlib
+#include "hardware/dma.h"
 #include "hardware/pio.h"
 #include "ws2812.pio.h"
 
-LEDs::LEDs()
+namespace
 {
-    ws2812_program_init(pio0, 0, pio_add_program(pio0, &ws2812_program), LED_DATA_PIN, 800000, LED_IS_RGBW);
-
-    clear();
+// Transposes an 8x8 bit matrix held in 8 bytes, so byte n of the result holds bit 7 - n of every input byte,
+// with input byte n landing in bit n (Hacker's Delight 7-3, in 32-bit halves for the M0+)
+void transpose_bits(const std::array<std::uint8_t, 8>& rows, std::uint32_t* columns)
+{
+    std::uint32_t x{ std::uint32_t{ rows[7] } << 24 | std::uint32_t{ rows[6] } << 16 | std::uint32_t{ rows[5] } << 8 | rows[4] };
+    std::uint32_t y{ std::uint32_t{ rows[3] } << 24 | std::uint32_t{ rows[2] } << 16 | std::uint32_t{ rows[1] } << 8 | rows[0] };
+    std::uint32_t t{ (x ^ (x >> 7)) & 0x00aa00aa };
+    x ^= t ^ (t << 7);
+    t = (y ^ (y >> 7)) & 0x00aa00aa;
+    y ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000cccc;
+    x ^= t ^ (t << 14);
+    t = (y ^ (y >> 14)) & 0x0000cccc;
+    y ^= t ^ (t << 14);
+    t = (x & 0xf0f0f0f0) | ((y >> 4) & 0x0f0f0f0f);
+    y = ((x << 4) & 0xf0f0f0f0) | (y & 0x0f0f0f0f);
+    x = t;
+    for (std::size_t i{ 0 }; i < 4; ++i)
+    {
+        columns[i] = (x >> (24 - 8 * i)) & 0xff;
+        columns[i + 4] = (y >> (24 - 8 * i)) & 0xff;
+    }
+}
 }
 
-void LEDs::put_pixel(color pixel)
+LEDs::LEDs()
 {
-    const std::uint32_t c{
-        (static_cast<std::uint32_t>(pixel.r) << 8) | (static_cast<std::uint32_t>(pixel.g) << 16) | static_cast<std::uint32_t>(pixel.b)};
-    pixels[next_pixel] = pixel;
-    pio_sm_put_blocking(pio0, 0, c << 8u);
-    next_pixel = (next_pixel + 1) % (led_count);
+    if constexpr (LED_SEGMENT_COUNT == 1)
+    {
+        ws2812_program_init(pio0, 0, pio_add_program(pio0, &ws2812_program), LED_DATA_PIN, bit_frequency, LED_IS_RGBW);
+    }
+    else
+    {
+        ws2812_parallel_program_init(pio0, 0, pio_add_program(pio0, &ws2812_parallel_program), LED_DATA_PIN, LED_SEGMENT_COUNT, bit_frequency);
+    }
+
+    dma_channel = static_cast<std::uint32_t>(dma_claim_unused_channel(true));
+    dma_channel_config config{ dma_channel_get_default_config(dma_channel) };
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, pio_get_dreq(pio0, 0, true));
+    dma_channel_configure(dma_channel, &config, &pio0->txf[0], nullptr, frame_word_count, false);
+
+    // The strip's state is unknown at power on, so the first (black) frame is sent even though nothing changed
+    start_transfer();
 }
 
 void LEDs::clear()
 {
-    show_pattern([]([[maybe_unused]] std::uint32_t x){ return colors::black; });
+    show_pattern([]([[maybe_unused]] std::uint32_t x){ return packed_colors::black; });
 }
 
 void LEDs::pattern_snakes(std::uint32_t t)
 {
-    show_pattern([&t](std::uint32_t i){
-        const std::uint32_t x{(i + t) % 64};
-        if (x < 10)
-        {
-            color c;
-            switch (((i + t) % (64 * 3)) / 64)
-            {
-            case 0:
-                c = colors::red;
-                break;
-            case 1:
-                c = colors::green;
-                break;
-            case 2:
-                c = colors::blue;
-                break;
-            }
-            if (x != 0)
-            {
-                c *= 0.1f;
-            }
-            return c;
-        }
-        return colors::black;
-    });
+    using attract_snakes = led_effects::snakes<>;
+    if constexpr (LED_BAKED_ATTRACT_MODE)
+    {
+        constexpr static auto frames{ led_effects::bake<attract_snakes::loop_ticks>([](std::uint32_t tick) {
+            return led_effects::pipeline{ attract_snakes{ tick } };
+        }) };
+        show_pattern(frames[t % frames.size()]);
+    }
+    else
+    {
+        show_pattern(led_effects::pipeline{ attract_snakes{ t } });
+    }
 }
 
-void LEDs::show_pattern(std::span<const color> pattern)
+void LEDs::show_pattern(std::span<const packed_color> pattern)
 {
-    sleep_us(100);
-    next_pixel = 0;
-    
-    for (const color& c : pattern)
+    for (std::size_t i{ 0 }; i < led_count; ++i)
     {
-        put_pixel(c);
+        pixels[i] = i < pattern.size() ? pattern[i] : packed_colors::black;
     }
+    submit_pixels();
 }
 
-void LEDs::show_pattern(const std::array<color, led_count>& pattern)
+void LEDs::show_pattern(const std::array<packed_color, led_count>& pattern)
 {
-    sleep_us(100);
-    next_pixel = 0;
-    
-    for (const color& c : pattern)
-    {
-        put_pixel(c);
-    }
+    pixels = pattern;
+    submit_pixels();
 }
 
-void LEDs::show_pattern(const std::array<color, visible_led_count>& pattern)
+void LEDs::show_pattern(const std::array<packed_color, visible_led_count>& pattern)
 {
-    sleep_us(100);
-    next_pixel = 0;
-    
+    auto pixel{ pixels.begin() };
     if (using_sacrificial_led)
     {
-        put_pixel(colors::black);
+        *pixel++ = packed_colors::black;
     }
-    
-    for (const color& c : pattern)
+    std::copy(pattern.begin(), pattern.end(), pixel);
+    submit_pixels();
+}
+
+void LEDs::update()
+{
+    if (frame_waiting && is_wire_idle())
     {
-        put_pixel(c);
+        front_index ^= 1;
+        frame_waiting = false;
+        start_transfer();
     }
 }
 
-void LEDs::show_pattern(std::function<color (std::uint32_t pixel_index)> generator)
+bool LEDs::is_frame_done() const
 {
-    sleep_us(100);
-    next_pixel = 0;
+    return !frame_waiting && is_wire_idle();
+}
 
-    for (std::uint32_t i{0}; i < led_count; ++i)
+color LEDs::get_pixel(std::size_t index) const
+{
+    return pixels.at(index).unpack();
+}
+
+void LEDs::set_brightness(brightness level)
+{
+    global_brightness = level;
+    channel_levels = make_channel_levels(level);
+    submit_pixels();
+}
+
+bool LEDs::is_wire_idle() const
+{
+    return !dma_channel_is_busy(dma_channel) && time_us_64() >= latched_at_us;
+}
+
+template <typename Level>
+std::uint32_t LEDs::encode_pixels(Level level)
+{
+    frame_buffer& back{ get_back_buffer() };
+    std::uint32_t level_sum{ 0 };
+    if constexpr (LED_SEGMENT_COUNT == 1)
+    {
+        for (std::size_t i{ 0 }; i < led_count; ++i)
+        {
+            const std::uint32_t grb{ pixels[i].grb };
+            const std::uint32_t g{ level((grb >> 16) & 0xff) };
+            const std::uint32_t r{ level((grb >> 8) & 0xff) };
+            const std::uint32_t b{ level(grb & 0xff) };
+            const std::uint32_t threshold{ dither_thresholds[(dither_frame + i) % dither_thresholds.size()] };
+            back[i] = (((g + threshold) >> 8) << 24) | (((r + threshold) >> 8) << 16) | (((b + threshold) >> 8) << 8);
+            level_sum += g + r + b;
+        }
+    }
+    else
     {
-        put_pixel(std::invoke(generator, i));
+        // Each LED position along the segments becomes 24 words, one per bit, most significant first.
+        // Segments shorter than the longest send black past their end, which falls off the last LED.
+        auto word{ back.begin() };
+        for (std::size_t position{ 0 }; position < longest_led_segment; ++position)
+        {
+            std::array<std::uint32_t, 8> grb{};
+            std::array<std::uint32_t, 8> thresholds{};
+            for (std::size_t s{ 0 }; s < led_segments.size(); ++s)
+            {
+                const led_segment& segment{ led_segments[s] };
+                if (position < segment.length)
+                {
+                    const std::size_t i{ segment.first_led + (segment.reversed ? segment.length - 1 - position : position) };
+                    grb[s] = pixels[i].grb;
+                    thresholds[s] = dither_thresholds[(dither_frame + i) % dither_thresholds.size()];
+                }
+            }
+            for (const std::uint32_t shift : { 16u, 8u, 0u }) // Green, red, blue
+            {
+                std::array<std::uint8_t, 8> rows;
+                for (std::size_t s{ 0 }; s < rows.size(); ++s)
+                {
+                    const std::uint32_t channel{ level((grb[s] >> shift) & 0xff) };
+                    rows[s] = static_cast<std::uint8_t>((channel + thresholds[s]) >> 8);
+                    level_sum += channel;
+                }
+                transpose_bits(rows, &*word);
+                word += 8;
+            }
+        }
     }
+    return level_sum;
 }
 
+void LEDs::submit_pixels()
+{
+    const std::uint32_t level_sum{ encode_pixels([this](std::uint32_t channel) { return channel_levels[channel]; }) };
+    ++current_stats.frames;
+    current_stats.peak_ma = std::max(current_stats.peak_ma, estimate_ma(level_sum));
+    if (level_sum > max_level_sum)
+    {
+        // Rare, so the frame is simply encoded again, rounding down to stay under budget
+        const std::uint32_t scale{ static_cast<std::uint32_t>((std::uint64_t{ max_level_sum } << 16) / level_sum) };
+        encode_pixels([this, scale](std::uint32_t channel) {
+            return (channel_levels[channel] * scale) >> 16;
+        });
+        ++current_stats.limited_frames;
+    }
+    ++dither_frame;
+    // A frame matching the one on the strip would change nothing; it also replaces any frame still waiting
+    frame_waiting = get_back_buffer() != frames[front_index];
+    update();
+}
 
-const color &LEDs::get_pixel(std::size_t index) const
+void LEDs::start_transfer()
 {
-    return pixels.at(index);
+    dma_channel_transfer_from_buffer_now(dma_channel, frames[front_index].data(), frame_word_count);
+    // The DMA finishes as the last words enter the FIFO, so time the latch from the start of the frame
+    latched_at_us = time_us_64() + frame_time_us;
 }
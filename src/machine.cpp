@@ -1,10 +1,27 @@
 #include "machine.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    // A file in a song's directory
+    using song_file_path = std::array<char, FF_MAX_LFN + 16>;
+
+    song_file_path make_song_file_path(const char* song, const char* file_name)
+    {
+        song_file_path path;
+        std::snprintf(path.data(), path.size(), "%s/%s", song, file_name);
+        return path;
+    }
+}
 
 namespace States
 {
     SongList::SongList(Machine &machine)
     {
         machine.lcd.display("Loading songs...");
+        std::size_t pool_used{ 0 };
         for (const SDCard::FileEntry &entry : machine.sd.get_file_list("/"))
         {
             if (entry.type != SDCard::FileEntry::FileType::Directory)
@@ -12,22 +29,34 @@ namespace States
                 continue;
             }
             std::optional<FILINFO> file_info{
-                machine.sd.get_file_info((entry.name + "/song.wav").c_str())};
+                machine.sd.get_file_info(make_song_file_path(entry.name.c_str(), "song.wav").data())};
             if (!file_info.has_value())
             {
                 continue;
             }
-            songs.emplace_back(entry.name);
+            if (song_count == max_song_count || pool_used + entry.name.size() + 1 > name_pool.size())
+            {
+                print("SongList is full; skipping %s\n", entry.name.c_str());
+                continue;
+            }
+            name_offsets[song_count++] = static_cast<std::uint16_t>(pool_used);
+            std::memcpy(&name_pool[pool_used], entry.name.c_str(), entry.name.size() + 1);
+            pool_used += entry.name.size() + 1;
         }
     }
 
+    const char* SongList::get_song_name(std::size_t index) const
+    {
+        return &name_pool[name_offsets[index]];
+    }
+
     void SongList::operator()(Machine &machine)
     {
         if (current_index != last_song_index)
         {
-            if (songs.size() > 0)
+            if (song_count > 0)
             {
-                machine.lcd.display(songs[current_index]);
+                machine.lcd.display(get_song_name(current_index));
             }
             else
             {
@@ -35,26 +64,32 @@ namespace States
             }
             last_song_index = current_index;
         }
-        if (songs.size() == 0)
+        if (machine.buttons.left.blue.get_state() == Button::State::Pressed)
+        {
+            machine.switch_state<Calibrate>();
+            return;
+        }
+        if (song_count == 0)
         {
             return;
         }
         if (machine.buttons.right.blue.get_state() == Button::State::Pressed)
         {
-            machine.current_song_path = songs[current_index];
-            Audio::start_streaming_wave({(songs[current_index] + "/song.wav").c_str()});
+            const char* song{ get_song_name(current_index) };
+            std::snprintf(machine.current_song_path.data(), machine.current_song_path.size(), "%s", song);
+            Audio::start_streaming_wave({ make_song_file_path(song, "song.wav").data() });
             machine.switch_state<PlaySong>();
             return;
         }
         if (machine.buttons.right.red.get_state() == Button::State::Pressed)
         {
-            current_index = (current_index + 1) % songs.size();
+            current_index = (current_index + 1) % song_count;
         }
         if (machine.buttons.left.red.get_state() == Button::State::Pressed)
         {
             if (current_index == 0)
             {
-                current_index = songs.size() - 1;
+                current_index = song_count - 1;
             }
             else
             {
@@ -67,13 +102,124 @@ namespace States
         sleep_ms(12);
     }
 
+    Calibrate::Calibrate(Machine &machine)
+    {
+        machine.leds.clear();
+        machine.lcd.display("Tap to the click");
+        Audio::start_click_track(beat_samples);
+    }
+
+    void Calibrate::operator()(Machine &machine)
+    {
+        const std::optional<std::uint64_t> tap_us{ get_tap_us(machine) };
+        const std::uint64_t now_us{ time_us_64() };
+        switch (phase)
+        {
+        case Phase::Audio:
+        {
+            const std::optional<std::uint64_t> position{ Audio::get_playback_position() };
+            if (!tap_us.has_value() || !position.has_value())
+            {
+                break;
+            }
+            const std::int64_t tap_position_us{
+                static_cast<std::int64_t>(*position >> Audio::position_fraction_bits) - static_cast<std::int64_t>(now_us - *tap_us)
+            };
+            // Clicks are at every multiple of beat_us, from position 0
+            if (tap_position_us > beat_us / 2 && record_tap(tap_position_us % beat_us))
+            {
+                audio_tap_us = take_median_tap();
+                Audio::stop_streaming_wave();
+                machine.lcd.display("Tap to the flash");
+                phase = Phase::Visual;
+                visual_started_at_us = now_us + beat_us;
+            }
+            break;
+        }
+        case Phase::Visual:
+            if (now_us >= visual_started_at_us + flash_count * beat_us)
+            {
+                machine.leds.show_pattern([]([[maybe_unused]] std::uint32_t x) { return packed_colors::white; });
+                last_flash_at_us = time_us_64();
+                ++flash_count;
+                flash_lit = true;
+            }
+            else if (flash_lit && now_us - last_flash_at_us >= flash_us)
+            {
+                machine.leds.clear();
+                flash_lit = false;
+            }
+            if (tap_us.has_value() && flash_count > 0 && record_tap(static_cast<std::int64_t>(*tap_us - last_flash_at_us)))
+            {
+                machine.leds.clear();
+                finish(machine, take_median_tap());
+            }
+            break;
+        case Phase::Done:
+            if (tap_us.has_value())
+            {
+                machine.switch_state<SongList>();
+            }
+            break;
+        }
+    }
+
+    std::optional<std::uint64_t> Calibrate::get_tap_us(Machine &machine)
+    {
+        std::optional<std::uint64_t> tap_us;
+        for (const Machine::Buttons::ColorPair* pair : { &machine.buttons.left, &machine.buttons.right })
+        {
+            for (const Button* button : { &pair->red, &pair->green, &pair->blue })
+            {
+                if (button->get_state() == Button::State::Pressed)
+                {
+                    tap_us = std::max(tap_us.value_or(0), button->get_changed_at_us());
+                }
+            }
+        }
+        return tap_us;
+    }
+
+    bool Calibrate::record_tap(std::int64_t since_beat_us)
+    {
+        // Taps in the second half of a beat are early for the next one
+        taps[tap_count++] = static_cast<std::int32_t>(since_beat_us > beat_us / 2 ? since_beat_us - beat_us : since_beat_us);
+        return tap_count == taps.size();
+    }
+
+    std::int32_t Calibrate::take_median_tap()
+    {
+        // The median ignores the odd tap which was way off
+        std::nth_element(taps.begin(), taps.begin() + taps.size() / 2, taps.end());
+        tap_count = 0;
+        return taps[taps.size() / 2];
+    }
+
+    void Calibrate::finish(Machine &machine, std::int32_t visual_tap_us)
+    {
+        // The player's own lag can't be told apart from the buttons', so all of it goes in input_us. The LEDs'
+        // latency is known: a frame has latched frame_time_us after it is submitted.
+        LatencyOffsets& offsets{ machine.latency_offsets };
+        offsets.visual_us = static_cast<std::int32_t>(LEDs::frame_time_us);
+        offsets.input_us = visual_tap_us - offsets.visual_us;
+        offsets.audio_us = audio_tap_us - offsets.input_us;
+        const bool saved{ offsets.save(machine.sd) };
+
+        char summary[40];
+        std::snprintf(summary, sizeof(summary), "A%+ldms I%+ldms  %s",
+            static_cast<long>(offsets.audio_us / 1000), static_cast<long>(offsets.input_us / 1000), saved ? "Saved" : "Not saved");
+        machine.lcd.display(summary);
+        phase = Phase::Done;
+    }
+
     PlaySong::PlaySong(Machine &machine)
     {
         machine.leds.clear();
         machine.lcd.display(std::to_string(score));
-        if (const auto loaded_song{ song_data::Song::load_from_note_file({(machine.current_song_path + "/song.note").c_str()}) })
+        if (auto loaded_song{ song_data::Song::load_from_note_file({ make_song_file_path(machine.current_song_path.data(), "song.note").data() }, max_loaded_note_count, machine.latency_offsets) })
         {
-            song = loaded_song.value();
+            song = std::move(*loaded_song);
+            judge = song_data::Judge{ song.header.difficulty };
         }
         else
         {
@@ -84,20 +230,111 @@ namespace States
 
     void PlaySong::operator()(Machine &machine)
     {
-        const std::uint64_t now_ms{ time_us_64() / 1000ull };
-        if (now_ms != last_update_ms)
+        update_timeline();
+        song.current_time_ms = static_cast<std::uint32_t>((song_position >> Audio::position_fraction_bits) / 1000);
+        if (song.current_time_ms != last_rendered_ms)
         {
-            if (last_update_ms == ~0)
-            {
-                last_update_ms = now_ms; // Ensures the first loop has a delta time of 0
-            }
-            song.current_time_ms += now_ms - last_update_ms;
-            last_update_ms = now_ms;
+            last_rendered_ms = song.current_time_ms;
 
             const auto leds{ song.render_leds() };
             sleep_ms(4);
             machine.leds.show_pattern(leds);
         }
+        judge_buttons(machine);
+
+        using song_data::Judge;
+        using song_data::Note;
+        const bool quit_gesture{
+            machine.buttons.left.blue.get_state() == Button::State::Held
+            && machine.buttons.right.blue.get_state() == Button::State::Held
+            && !judge.is_holding(Judge::get_lane(Note::Blue, Note::Left))
+            && !judge.is_holding(Judge::get_lane(Note::Blue, Note::Right))
+        };
+        if (!quit_gesture)
+        {
+            quit_held_since_us.reset();
+        }
+        else if (!quit_held_since_us.has_value())
+        {
+            quit_held_since_us = time_us_64();
+        }
+        const bool quit_held{ quit_held_since_us.has_value() && time_us_64() - *quit_held_since_us >= quit_hold_us };
+        const bool audio_finished{ heard_audio && !Audio::get_playback_position().has_value() };
+        if (quit_held || audio_finished)
+        {
+            Audio::stop_streaming_wave();
+            machine.switch_state<SongList>();
+        }
+    }
+
+    void PlaySong::update_timeline()
+    {
+        const std::uint64_t now_us{ time_us_64() };
+        if (const std::optional<std::uint64_t> position{ Audio::get_playback_position() })
+        {
+            song_position = std::max(song_position, *position);
+            heard_audio = true;
+        }
+        else if (position_at_us != ~0ull)
+        {
+            song_position += (now_us - position_at_us) << Audio::position_fraction_bits;
+        }
+        position_at_us = now_us;
+    }
+
+    std::int64_t PlaySong::get_song_time_us(std::uint64_t time_us) const
+    {
+        return static_cast<std::int64_t>(song_position >> Audio::position_fraction_bits)
+            - static_cast<std::int64_t>(position_at_us - time_us);
+    }
+
+    void PlaySong::judge_buttons(Machine &machine)
+    {
+        using song_data::Judge;
+        using song_data::Note;
+        struct LaneEvent
+        {
+            std::uint64_t time_us;
+            std::size_t lane;
+            bool is_press;
+        };
+        // Each button changes state at most once an update, so there is at most one event per lane
+        std::array<LaneEvent, Judge::lane_count> events;
+        std::size_t event_count{ 0 };
+        const auto add_event{ [&](const Button& button, Note::Color note_color, Note::Direction direction) {
+            const Button::State state{ button.get_state() };
+            if (state == Button::State::Pressed || state == Button::State::Released)
+            {
+                events[event_count++] = { button.get_changed_at_us(), Judge::get_lane(note_color, direction), state == Button::State::Pressed };
+            }
+        } };
+        add_event(machine.buttons.left.red, Note::Red, Note::Left);
+        add_event(machine.buttons.left.green, Note::Green, Note::Left);
+        add_event(machine.buttons.left.blue, Note::Blue, Note::Left);
+        add_event(machine.buttons.right.red, Note::Red, Note::Right);
+        add_event(machine.buttons.right.green, Note::Green, Note::Right);
+        add_event(machine.buttons.right.blue, Note::Blue, Note::Right);
+        // Judged in the order they happened, so grades and the combo follow the player rather than the button order
+        std::sort(events.begin(), events.begin() + event_count, [](const LaneEvent& lhs, const LaneEvent& rhs) { return lhs.time_us < rhs.time_us; });
+
+        std::uint32_t points{ 0 };
+        for (std::size_t i{ 0 }; i < event_count; ++i)
+        {
+            const std::int64_t song_time_us{ get_song_time_us(events[i].time_us) };
+            points += events[i].is_press
+                ? judge.press(song, events[i].lane, song_time_us)
+                : judge.release(song, events[i].lane, song_time_us);
+        }
+        points += judge.update(song, get_song_time_us(position_at_us));
+        if (points != 0)
+        {
+            increment_score(machine, points);
+        }
+    }
+
+    void PlaySong::refill_streams([[maybe_unused]] Machine &machine)
+    {
+        song.refill_note_stream(judge.get_first_unjudged_note());
     }
 
     void PlaySong::increment_score(Machine &machine, std::uint32_t val)
@@ -118,8 +355,8 @@ Machine::Machine()
         lcd.display("SD Card Error!");
         exit(1);
     }
-    current_state = std::make_unique<States::SongList>(*this);
-    //current_state = std::make_unique<States::PlaySong>(*this);
+    latency_offsets = LatencyOffsets::load(sd).value_or(LatencyOffsets{});
+    current_state.emplace<States::SongList>(*this);
 }
 
 void Machine::update()
@@ -131,15 +368,30 @@ void Machine::update()
     buttons.right.green.update();
     buttons.right.blue.update();
     Audio::stream_wave_to_inactive_buffer();
+    leds.update();
+    lcd.update();
 
-    if (current_state)
+    if (std::holds_alternative<std::monostate>(current_state))
     {
-        (*current_state)(*this);
-        ++current_tick;
-        if (next_state)
+        return;
+    }
+    std::visit([this](auto& state) {
+        if constexpr (!std::is_same_v<std::decay_t<decltype(state)>, std::monostate>)
         {
-            current_state = std::move(next_state);
+            if constexpr (requires { state.refill_streams(*this); })
+            {
+                state.refill_streams(*this);
+            }
+            state(*this);
         }
+    }, current_state);
+    ++current_tick;
+    // Entering a state can switch again straight away, as PlaySong does when its chart fails to load
+    while (enter_next_state != nullptr)
+    {
+        const auto enter_state{ enter_next_state };
+        enter_next_state = nullptr;
+        enter_state(*this);
     }
 }
 
@@ -7,7 +7,8 @@ int main()
     stdio_init_all();
 
     printf("Hello\n");
-    Machine machine;
+    // Static, since the state storage is too big for the stack
+    static Machine machine;
 
     while (1)
     {
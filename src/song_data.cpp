@@ -1,22 +1,122 @@
 #include "song_data.h"
 #include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <numeric>
 
 namespace song_data
 {
-    color Note::get_pixel_color(bool bright /* = true */) const
+    namespace
     {
-        const float brightness{ bright ? 1.0f : 0.1f };
-        switch (note_color)
+        // Indexed by whether the pixel is a note's head, then its color; hold trails are dimmed
+        constexpr std::array<std::array<packed_color, 3>, 2> note_palette{ {
+            { packed_colors::red * brightnesses::dim, packed_colors::green * brightnesses::dim, packed_colors::blue * brightnesses::dim },
+            { packed_colors::red, packed_colors::green, packed_colors::blue },
+        } };
+
+        // Brightness which gives off i / 256 of a color's light, so a note head split across two LEDs stays as bright
+        constexpr std::array<brightness, 257> head_split{ [] {
+            std::array<brightness, 257> split{};
+            for (std::size_t i{ 0 }; i < split.size(); ++i)
+            {
+                split[i].value = static_cast<std::uint16_t>(gamma_curve::to_perceived(i / 256.0) * brightness::full_value + 0.5);
+            }
+            return split;
+        }() };
+
+        // A color with each channel in a 21-bit lane, wide enough to sum thousands of colors without carrying over
+        using wide_color = std::uint64_t;
+        constexpr std::uint32_t wide_lane_bits{ 21 };
+        constexpr wide_color wide_lane_mask{ (wide_color{ 1 } << wide_lane_bits) - 1 };
+
+        constexpr wide_color widen(packed_color c)
+        {
+            return (wide_color{ c.grb >> 16 } << (2 * wide_lane_bits)) | (wide_color{ (c.grb >> 8) & 0xff } << wide_lane_bits) | (c.grb & 0xff);
+        }
+
+        // Clamps each channel to 0xff
+        constexpr packed_color narrow(wide_color c)
+        {
+            // The bits above 0xff in every lane
+            constexpr wide_color lane_over_mask{ wide_lane_mask & ~wide_color{ 0xff } };
+            constexpr wide_color over_mask{ lane_over_mask | (lane_over_mask << wide_lane_bits) | (lane_over_mask << (2 * wide_lane_bits)) };
+            if ((c & over_mask) != 0)
+            {
+                for (std::uint32_t lane{ 0 }; lane < 3; ++lane)
+                {
+                    const std::uint32_t shift{ lane * wide_lane_bits };
+                    if (((c >> shift) & wide_lane_mask) > 0xff)
+                    {
+                        c = (c & ~(wide_lane_mask << shift)) | (wide_color{ 0xff } << shift);
+                    }
+                }
+            }
+            return { static_cast<std::uint32_t>(((c >> (2 * wide_lane_bits - 16)) & 0xff0000) | ((c >> (wide_lane_bits - 8)) & 0xff00) | (c & 0xff)) };
+        }
+
+        constexpr std::uint8_t encoded_color_mask{ 0b11 };
+        constexpr std::uint8_t encoded_direction_shift{ 2 };
+        constexpr std::uint8_t encoded_has_length{ 1 << 3 };
+        constexpr std::uint8_t encoded_has_speed{ 1 << 4 };
+        constexpr std::uint8_t encoded_unused_bits{ 0b1110'0000 };
+
+        // CRC-32 as used by zlib, so song_compiler.py can use zlib.crc32
+        constexpr std::array<std::uint32_t, 256> crc32_table{ [] {
+            std::array<std::uint32_t, 256> table{};
+            for (std::uint32_t i{ 0 }; i < table.size(); ++i)
+            {
+                std::uint32_t value{ i };
+                for (int bit{ 0 }; bit < 8; ++bit)
+                {
+                    value = (value & 1) ? 0xedb88320u ^ (value >> 1) : value >> 1;
+                }
+                table[i] = value;
+            }
+            return table;
+        }() };
+
+        std::uint32_t update_crc32(std::uint32_t crc, std::span<const std::uint8_t> bytes)
+        {
+            crc = ~crc;
+            for (const std::uint8_t byte : bytes)
+            {
+                crc = crc32_table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+            }
+            return ~crc;
+        }
+    }
+
+    bool Note::validate() const
+    {
+        return note_color <= Color::Blue && direction <= Direction::Counterclockwise;
+    }
+
+    std::uint32_t Note::get_fixed_speed() const
+    {
+        if (!std::isfinite(speed) || speed <= 0.0f)
+        {
+            return speed_one;
+        }
+        const float clamped_speed{ std::clamp(
+            speed,
+            static_cast<float>(min_fixed_speed) / speed_one,
+            static_cast<float>(max_fixed_speed) / speed_one
+        ) };
+        return static_cast<std::uint32_t>(std::lround(clamped_speed * speed_one));
+    }
+
+    packed_color Note::get_pixel_color(bool bright /* = true */) const
+    {
+        return get_pixel_color(note_color, bright);
+    }
+
+    packed_color Note::get_pixel_color(Color note_color, bool bright)
+    {
+        if (note_color > Color::Blue)
         {
-        case Color::Red:
-            return colors::red * brightness;
-        case Color::Green:
-            return colors::green * brightness;
-        case Color::Blue:
-            return colors::blue * brightness;
+            return packed_colors::black;
         }
-        return colors::black;
+        return note_palette[bright][note_color];
     }
 
     bool Song::Header::validate() const
@@ -25,7 +125,7 @@ namespace song_data
         {
             return false;
         }
-        if (version_major != Song::verison_major)
+        if (version_major < Song::oldest_version_major || version_major > Song::verison_major)
         {
             return false;
         }
@@ -33,117 +133,672 @@ namespace song_data
         {
             return false;
         }
+        if (ms_per_pixel == 0 || ms_per_pixel > (1u << pixel_fraction_bits))
+        {
+            return false;
+        }
+        return true;
+    }
+
+    FSIZE_t Song::Header::get_body_size() const
+    {
+        if (version_major == 1)
+        {
+            return static_cast<FSIZE_t>(note_count) * sizeof(Note);
+        }
+        return static_cast<FSIZE_t>(block_count) * sizeof(BlockIndexEntry) + note_data_size;
+    }
+
+    Song::NoteReader::NoteReader(SDCard::FileReader file, const Header& header, std::size_t buffer_size)
+        : file{ file }
+        , version_major{ header.version_major }
+        , block_count{ header.block_count }
+        , note_data_size{ header.note_data_size }
+        , expected_checksum{ header.checksum }
+        , buffer(version_major == 1 ? 0 : std::max(buffer_size, max_encoded_note_size))
+    {
+        rewind();
+    }
+
+    void Song::NoteReader::rewind()
+    {
+        file.seek_absolute(sizeof(Header));
+        body_remaining = static_cast<FSIZE_t>(block_count) * sizeof(BlockIndexEntry) + note_data_size;
+        index_bytes_to_skip = static_cast<FSIZE_t>(block_count) * sizeof(BlockIndexEntry);
+        checksum = 0;
+        checking = true;
+        previous_start_ms = 0;
+        buffer_position = 0;
+        buffer_size = 0;
+    }
+
+    bool Song::NoteReader::read(std::span<Note> notes)
+    {
+        if (version_major == 1)
+        {
+            return file.read_bytes(std::as_writable_bytes(notes));
+        }
+        for (Note& note : notes)
+        {
+            if (!decode(note))
+            {
+                print("NoteReader found corrupt note data\n");
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Song::NoteReader::verify_checksum()
+    {
+        if (version_major == 1)
+        {
+            return true;
+        }
+        while (body_remaining > 0)
+        {
+            buffer_position = buffer_size;
+            if (!fill_buffer())
+            {
+                return false;
+            }
+        }
+        rewind();
+        return true;
+    }
+
+    std::optional<std::uint32_t> Song::NoteReader::seek(std::uint32_t time_ms)
+    {
+        if (version_major == 1 || block_count == 0)
+        {
+            return std::nullopt;
+        }
+        const std::uint32_t block{ std::min(time_ms / BlockIndexEntry::block_ms, block_count - 1) };
+        BlockIndexEntry entry;
+        file.seek_absolute(sizeof(Header) + static_cast<FSIZE_t>(block) * sizeof(BlockIndexEntry));
+        if (!file.read(entry) || entry.data_offset > note_data_size)
+        {
+            return std::nullopt;
+        }
+        file.seek_absolute(sizeof(Header) + static_cast<FSIZE_t>(block_count) * sizeof(BlockIndexEntry) + entry.data_offset);
+        body_remaining = note_data_size - entry.data_offset;
+        index_bytes_to_skip = 0;
+        checking = false;
+        previous_start_ms = entry.previous_start_ms;
+        buffer_position = 0;
+        buffer_size = 0;
+        return entry.first_note;
+    }
+
+    // Tops the buffer up from the file, keeping the bytes not decoded yet
+    bool Song::NoteReader::fill_buffer()
+    {
+        const std::size_t kept_size{ buffer_size - buffer_position };
+        std::memmove(buffer.data(), buffer.data() + buffer_position, kept_size);
+        buffer_position = 0;
+        buffer_size = kept_size;
+        std::size_t read_size{ static_cast<std::size_t>(std::min<FSIZE_t>(buffer.size() - kept_size, body_remaining)) };
+        if (read_size == 0)
+        {
+            return true;
+        }
+        // Ending on a sector boundary keeps the next read aligned, so FatFs can move whole sectors straight into the buffer
+        constexpr FSIZE_t sector_size{ FF_MAX_SS };
+        const std::size_t past_sector{ static_cast<std::size_t>((file.get_current_offset() + read_size) % sector_size) };
+        if (read_size < body_remaining && read_size > past_sector)
+        {
+            read_size -= past_sector;
+        }
+        const std::span<std::uint8_t> new_bytes{ buffer.data() + kept_size, read_size };
+        if (!file.read_bytes(new_bytes))
+        {
+            return false;
+        }
+        buffer_size += read_size;
+        body_remaining -= read_size;
+        if (checking)
+        {
+            checksum = update_crc32(checksum, new_bytes);
+            if (body_remaining == 0 && checksum != expected_checksum)
+            {
+                print("NoteReader checksum mismatch; expected %08x, got %08x\n", expected_checksum, checksum);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Song::NoteReader::read_varint(std::uint32_t& out_value)
+    {
+        std::uint32_t value{ 0 };
+        for (std::uint32_t shift{ 0 }; shift < 35; shift += 7)
+        {
+            if (buffer_position == buffer_size)
+            {
+                return false;
+            }
+            const std::uint8_t byte{ buffer[buffer_position++] };
+            value |= static_cast<std::uint32_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                out_value = value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Song::NoteReader::decode(Note& note)
+    {
+        // The block index comes first, so it is part of the checksum
+        while (index_bytes_to_skip > 0)
+        {
+            if (buffer_position == buffer_size && (!fill_buffer() || buffer_size == 0))
+            {
+                return false;
+            }
+            const std::size_t skipped{ static_cast<std::size_t>(std::min<FSIZE_t>(index_bytes_to_skip, buffer_size - buffer_position)) };
+            buffer_position += skipped;
+            index_bytes_to_skip -= skipped;
+        }
+        if (buffer_size - buffer_position < max_encoded_note_size && !fill_buffer())
+        {
+            return false;
+        }
+        if (buffer_position == buffer_size)
+        {
+            return false;
+        }
+        const std::uint8_t attributes{ buffer[buffer_position++] };
+        std::uint32_t start_delta_ms;
+        if ((attributes & encoded_unused_bits) != 0 || !read_varint(start_delta_ms))
+        {
+            return false;
+        }
+        note = {};
+        note.note_color = static_cast<Note::Color>(attributes & encoded_color_mask);
+        note.direction = static_cast<Note::Direction>((attributes >> encoded_direction_shift) & 1);
+        note.start_ms = previous_start_ms + start_delta_ms;
+        previous_start_ms = note.start_ms;
+        std::uint32_t length_ms{ 0 };
+        if ((attributes & encoded_has_length) != 0 && !read_varint(length_ms))
+        {
+            return false;
+        }
+        note.length_ms = length_ms;
+        if ((attributes & encoded_has_speed) != 0)
+        {
+            if (buffer_size - buffer_position < sizeof(float))
+            {
+                return false;
+            }
+            std::memcpy(&note.speed, buffer.data() + buffer_position, sizeof(float));
+            buffer_position += sizeof(float);
+        }
         return true;
     }
 
-    std::optional<Song> Song::load_from_note_file(SDCard::FileReader file)
+    void NoteTable::reserve(std::size_t count)
+    {
+        for_each_array([count](auto& array) { array.reserve(count); });
+    }
+
+    void NoteTable::clear()
+    {
+        for_each_array([](auto& array) { array.clear(); });
+        speed_class_count = 0;
+    }
+
+    bool NoteTable::push_back(const Note& note, std::int64_t start_position)
+    {
+        if (start_position < 0 || start_position > std::numeric_limits<std::uint32_t>::max()
+            || note.length_ms > std::numeric_limits<std::uint16_t>::max())
+        {
+            return false;
+        }
+        const std::uint32_t speed{ note.get_fixed_speed() };
+        const auto used_speed_classes_end{ speed_classes.begin() + speed_class_count };
+        const std::size_t speed_class{ static_cast<std::size_t>(std::find(speed_classes.begin(), used_speed_classes_end, speed) - speed_classes.begin()) };
+        if (speed_class == speed_class_count)
+        {
+            if (speed_class_count == max_speed_classes)
+            {
+                return false;
+            }
+            speed_classes[speed_class_count++] = speed;
+        }
+        start_positions.push_back(static_cast<std::uint32_t>(start_position));
+        length_ms.push_back(static_cast<std::uint16_t>(note.length_ms));
+        attributes.push_back(static_cast<std::uint8_t>(
+            note.note_color
+            | (note.direction << direction_shift)
+            | (speed_class << speed_class_shift)
+        ));
+        return true;
+    }
+
+    void NoteTable::erase_front(std::size_t count)
+    {
+        for_each_array([count](auto& array) { array.erase(array.begin(), array.begin() + count); });
+    }
+
+    void NoteTable::truncate(std::size_t count)
+    {
+        for_each_array([count](auto& array) { array.resize(count); });
+    }
+
+    bool NoteTable::is_sorted() const
+    {
+        return std::is_sorted(start_positions.begin(), start_positions.end());
+    }
+
+    void NoteTable::stable_sort()
+    {
+        std::vector<std::size_t> order(size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [this](std::size_t lhs, std::size_t rhs) { return start_positions[lhs] < start_positions[rhs]; });
+        for_each_array([&order](auto& array) {
+            std::remove_reference_t<decltype(array)> sorted;
+            sorted.reserve(array.size());
+            for (const std::size_t index : order)
+            {
+                sorted.push_back(array[index]);
+            }
+            array = std::move(sorted);
+        });
+    }
+
+    std::optional<Song> Song::load_from_note_file(
+        SDCard::FileReader file,
+        std::uint32_t max_loaded_notes /* = std::numeric_limits<std::uint32_t>::max() */,
+        const LatencyOffsets& offsets /* = {} */
+    )
     {
         Header header;
         if (!file.read(header) || !header.validate())
         {
             return std::nullopt;
         }
-        Song song{ header };
-        for (Note& note : song.notes)
+        if (file.get_size() < sizeof(Header) + header.get_body_size())
         {
-            if (!file.read(note))
+            return std::nullopt;
+        }
+        if (header.note_count > max_loaded_notes)
+        {
+            Song song;
+            song.set_header(header);
+            song.set_offsets(offsets);
+            song.notes.reserve(streamed_note_capacity);
+            song.stream_buffer.resize(stream_refill_batch);
+            song.streamed_notes_remaining = header.note_count;
+            // Notes are played as they are read, so corruption has to be caught up front
+            if (!song.note_stream.emplace(file, header, stream_read_buffer_size).verify_checksum())
             {
                 return std::nullopt;
             }
+            while (song.notes.size() < streamed_note_capacity && song.streamed_notes_remaining > 0)
+            {
+                if (!song.read_streamed_notes())
+                {
+                    return std::nullopt;
+                }
+            }
+            return song;
+        }
+        Song song;
+        song.set_header(header);
+        // Reserving for the most notes that load, rather than this chart's count, makes every bounded load allocate
+        // the same, so playing song after song reuses the same blocks instead of fragmenting the heap
+        song.notes.reserve(max_loaded_notes != std::numeric_limits<std::uint32_t>::max() ? max_loaded_notes : header.note_count);
+        song.set_offsets(offsets);
+        NoteReader reader{ file, header, load_read_buffer_size };
+        // Large reads let FatFs move whole sectors straight into the buffer, which is freed once the notes are converted
+        song.stream_buffer.resize(std::min(header.note_count, load_batch_note_count));
+        if (!song.read_notes(reader, header.note_count))
+        {
+            return std::nullopt;
+        }
+        song.stream_buffer = {};
+        if (!song.notes.is_sorted())
+        {
+            song.sort_notes();
         }
         return song;
     }
 
-    std::array<color, visible_led_count> Song::render_leds() const
+    void Song::set_header(const Header& new_header)
+    {
+        header = new_header;
+        constexpr std::uint64_t one{ std::uint64_t{ 1 } << (pixel_fraction_bits + Note::speed_fraction_bits) };
+        // Rounded up, so a hold which ends on a whole position converts to exactly that
+        position_per_ms = header.ms_per_pixel == 0 ? 0 : static_cast<std::uint32_t>((one + header.ms_per_pixel - 1) / header.ms_per_pixel);
+    }
+
+    void Song::set_offsets(const LatencyOffsets& offsets)
+    {
+        const auto to_ms{ [](std::int32_t us) { return (us + (us < 0 ? -500 : 500)) / 1000; } };
+        // A note lights up ahead of being heard by as long as the LEDs take over the audio, and is pressed later by
+        // as long as the input takes
+        render_offset_ms = header.offset_ms + to_ms(offsets.audio_us - offsets.visual_us);
+        judge_offset_ms = header.offset_ms + to_ms(offsets.audio_us + offsets.input_us);
+    }
+
+    bool Song::add_note(const Note& note)
+    {
+        const std::uint32_t render_start_ms{ static_cast<std::uint32_t>(std::max<std::int64_t>(std::int64_t{ note.start_ms } + render_offset_ms, 0)) };
+        if (!notes.push_back(note, note_time_to_pixel_position(render_start_ms)))
+        {
+            return false;
+        }
+        const std::uint64_t ms_per_pixel_fixed{ static_cast<std::uint64_t>(header.ms_per_pixel) << Note::speed_fraction_bits };
+        // Generous by a couple of ms to cover the rounding of the fixed-point positions
+        const std::uint64_t ms_per_scaled_pixel{ ms_per_pixel_fixed / note.get_fixed_speed() + 2 };
+        // Seeks go by the judged start, so these reach as far again as the render and judge offsets differ
+        const std::uint32_t offset_spread_ms{ static_cast<std::uint32_t>(std::abs(judge_offset_ms - render_offset_ms)) };
+        lookahead_ms = static_cast<std::uint32_t>(std::max<std::uint64_t>(lookahead_ms, ms_per_scaled_pixel * (visible_led_count + 1) + offset_spread_ms));
+        trailing_ms = static_cast<std::uint32_t>(std::max<std::uint64_t>(trailing_ms, note.length_ms + ms_per_scaled_pixel + offset_spread_ms));
+        return true;
+    }
+
+    void Song::sort_notes()
+    {
+        notes.stable_sort();
+        visible_window = {};
+    }
+
+    Song::PixelNote Song::get_pixel_note(std::size_t index) const
     {
-        std::array<color, visible_led_count> leds{ colors::black };
-        // TODO: Figure out this math to improve efficiency of note lookup
-        // const auto first_shown_note{
-        //     std::lower_bound(
-        //         notes.begin(), notes.end(),
-        //         Note{ .start_ms = current_time_ms, .end_ms = current_time_ms },
-        //         [](const Note& lhs, const Note& rhs) { return lhs.start_ms > rhs.start_ms || lhs.end_ms <= rhs.end_ms; }
-        //     )
-        // };
-        // const auto last_shown_note{
-        //     std::upper_bound(
-        //         notes.begin(), notes.end(),
-        //         Note{ .start_ms = current_time_ms, .end_ms = current_time_ms },
-        //         [](const Note& lhs, const Note& rhs) { return lhs.start_ms > rhs.start_ms || lhs.end_ms <= rhs.end_ms; }
-        //     )
-        // };
+        const std::int64_t start{ notes.get_start_position(index) };
+        return {
+            .start = start,
+            .end = start + ((std::int64_t{ notes.get_length_ms(index) } * position_per_ms) >> Note::speed_fraction_bits),
+            .speed = notes.get_speed(index),
+            .note_color = notes.get_color(index),
+            .direction = notes.get_direction(index),
+        };
+    }
+
+    std::uint32_t Song::get_note_start_ms(std::size_t index) const
+    {
+        const std::int64_t position{ notes.get_start_position(index) };
+        const std::int64_t fraction{ position & ((1 << pixel_fraction_bits) - 1) };
+        // The fraction was rounded down from a remainder of less than ms_per_pixel, and a pixel is at most
+        // 1 << pixel_fraction_bits ms, so rounding back up gives the remainder exactly
+        const std::int64_t render_start_ms{
+            (position >> pixel_fraction_bits) * header.ms_per_pixel
+            + ((fraction * header.ms_per_pixel + (1 << pixel_fraction_bits) - 1) >> pixel_fraction_bits)
+        };
+        return static_cast<std::uint32_t>(std::max<std::int64_t>(render_start_ms - render_offset_ms + judge_offset_ms, 0));
+    }
 
-        //for (auto Note{ first_shown_note }; note != last_shown_note; ++note)
-        for (const Note& note : notes)
+    // Reads count notes through stream_buffer and adds them; false if the read fails or a note can't be added
+    bool Song::read_notes(NoteReader& reader, std::size_t count)
+    {
+        while (count > 0)
         {
-            if (note.start_ms - pixel_count_to_note_length(visible_led_count) > current_time_ms)
+            const std::span<Note> batch{ stream_buffer.data(), std::min(count, stream_buffer.size()) };
+            if (!reader.read(batch))
+            {
+                print("Song failed to read notes\n");
+                return false;
+            }
+            for (const Note& note : batch)
+            {
+                if (!note.validate() || !add_note(note))
+                {
+                    print("Song found an invalid note\n");
+                    return false;
+                }
+            }
+            count -= batch.size();
+        }
+        return true;
+    }
+
+    bool Song::read_streamed_notes()
+    {
+        const std::size_t first_new_note{ notes.size() };
+        const std::size_t count{ std::min<std::size_t>({
+            stream_refill_batch,
+            streamed_note_capacity - first_new_note,
+            streamed_notes_remaining
+        }) };
+        streamed_notes_remaining -= static_cast<std::uint32_t>(count);
+        bool read_result{ read_notes(*note_stream, count) };
+        // A stream can't be sorted, so the chart ends at the first note out of order
+        for (std::size_t i{ std::max<std::size_t>(first_new_note, 1) }; read_result && i < notes.size(); ++i)
+        {
+            if (notes.get_start_position(i) < notes.get_start_position(i - 1))
+            {
+                print("Song found an unsorted streamed note; ending the stream\n");
+                notes.truncate(i);
+                read_result = false;
+            }
+        }
+        if (!read_result)
+        {
+            streamed_notes_remaining = 0;
+        }
+        return read_result;
+    }
+
+    bool Song::refill_note_stream(std::size_t keep_from_note /* = std::numeric_limits<std::size_t>::max() */)
+    {
+        if (streamed_notes_remaining == 0)
+        {
+            return false;
+        }
+        if (notes.size() + stream_refill_batch > streamed_note_capacity)
+        {
+            // Make room by dropping the notes which have left the ring and are no longer needed
+            const std::size_t expired_count{ std::min(
+                update_visible_window().tail,
+                keep_from_note - std::min(keep_from_note, dropped_note_count)
+            ) };
+            if (expired_count == 0)
+            {
+                return false;
+            }
+            notes.erase_front(expired_count);
+            dropped_note_count += expired_count;
+            visible_window.tail -= expired_count;
+            visible_window.head -= expired_count;
+        }
+        return read_streamed_notes();
+    }
+
+    bool Song::seek(std::uint32_t time_ms)
+    {
+        const bool moving_backwards{ time_ms < current_time_ms };
+        current_time_ms = time_ms;
+        if (!is_streamed())
+        {
+            return true;
+        }
+        const std::uint64_t newest_start_ms{ static_cast<std::uint64_t>(time_ms) + lookahead_ms };
+        const auto ring_reaches{ [this](std::uint64_t start_ms) {
+            return streamed_notes_remaining == 0 || (!notes.empty() && get_note_start_ms(notes.size() - 1) > start_ms);
+        } };
+        if (!moving_backwards && ring_reaches(newest_start_ms))
+        {
+            return true;
+        }
+        // The file has the notes' starts before judge_offset_ms was added
+        const std::int64_t oldest_start_ms{ std::int64_t{ time_ms } - trailing_ms - judge_offset_ms };
+        if (const std::optional<std::uint32_t> first_note{ note_stream->seek(static_cast<std::uint32_t>(std::max<std::int64_t>(oldest_start_ms, 0))) })
+        {
+            notes.clear();
+            visible_window = {};
+            dropped_note_count = *first_note;
+            streamed_notes_remaining = header.note_count - std::min(*first_note, header.note_count);
+            while (notes.size() < streamed_note_capacity && streamed_notes_remaining > 0 && read_streamed_notes())
+            {
+            }
+            return true;
+        }
+        if (moving_backwards)
+        {
+            return false;
+        }
+        // Without an index the stream has to be read through until it catches up
+        while (!ring_reaches(newest_start_ms) && refill_note_stream())
+        {
+        }
+        return true;
+    }
+
+    bool Song::NotePlacement::is_expired(Note::Direction direction) const
+    {
+        if (direction == Note::Direction::Counterclockwise)
+        {
+            return start_index - length_leds >= static_cast<std::int64_t>(visible_led_count);
+        }
+        return start_index + length_leds < 0;
+    }
+
+    const Song::VisibleWindow& Song::update_visible_window() const
+    {
+        const std::uint64_t newest_start_ms{ static_cast<std::uint64_t>(current_time_ms) + lookahead_ms };
+        const std::int64_t newest_start_position{
+            note_time_to_pixel_position(static_cast<std::uint32_t>(std::min<std::uint64_t>(newest_start_ms, std::numeric_limits<std::uint32_t>::max())))
+        };
+        VisibleWindow& window{ visible_window };
+        if (current_time_ms < window.time_ms || current_time_ms - window.time_ms > lookahead_ms)
+        {
+            // Seeking, so nothing in the old window can be reused
+            const std::int64_t oldest_start_position{ note_time_to_pixel_position(current_time_ms > trailing_ms ? current_time_ms - trailing_ms : 0) };
+            const std::span<const std::uint32_t> start_positions{ notes.get_start_positions() };
+            window.head = static_cast<std::size_t>(std::upper_bound(start_positions.begin(), start_positions.end(), newest_start_position) - start_positions.begin());
+            window.tail = static_cast<std::size_t>(std::lower_bound(start_positions.begin(), start_positions.begin() + window.head, oldest_start_position) - start_positions.begin());
+        }
+        while (window.head < notes.size() && notes.get_start_position(window.head) <= newest_start_position)
+        {
+            ++window.head;
+        }
+        // Holds and slow notes can outlast the notes after them, so the tail only moves past a contiguous run of expired notes
+        const std::int64_t current_position{ note_time_to_pixel_position(current_time_ms) };
+        while (window.tail < window.head)
+        {
+            const PixelNote note{ get_pixel_note(window.tail) };
+            if (!place_note(note, current_position).is_expired(note.direction))
+            {
+                break;
+            }
+            ++window.tail;
+        }
+        window.time_ms = current_time_ms;
+        return window;
+    }
+
+    std::array<packed_color, visible_led_count> Song::render_leds() const
+    {
+        std::array<packed_color, visible_led_count> leds{};
+        const auto add_head{ [&leds](std::int64_t index, packed_color c) {
+            if (index >= 0 && index < static_cast<std::int64_t>(visible_led_count))
+            {
+                leds[index] += c;
+            }
+        } };
+        // Trails add their colors over spans of LEDs into a difference array, so a long or overlapping trail costs the
+        // same as a short one. One prefix sum then gives the total for each LED, which is clamped once.
+        std::array<wide_color, visible_led_count + 1> spans;
+        bool has_spans{ false };
+        const auto add_span{ [&spans, &has_spans](std::int64_t first, std::int64_t last, packed_color c) {
+            first = std::clamp<std::int64_t>(first, 0, visible_led_count);
+            last = std::clamp<std::int64_t>(last, 0, visible_led_count);
+            if (first < last)
+            {
+                if (!has_spans)
+                {
+                    spans.fill(0);
+                    has_spans = true;
+                }
+                spans[first] += widen(c);
+                spans[last] -= widen(c);
+            }
+        } };
+
+        const VisibleWindow& window{ update_visible_window() };
+        const std::int64_t current_position{ note_time_to_pixel_position(current_time_ms) };
+        for (std::size_t note_index{ window.tail }; note_index < window.head; ++note_index)
+        {
+            const PixelNote note{ get_pixel_note(note_index) };
+            const auto [start_index, length_leds, head_position, upcoming]{ place_note(note, current_position) };
+            if (upcoming)
             {
                 continue;
             }
-            const std::int64_t length_leds{ note_length_to_pixel_count(note.length_ms) };
-            // convert start and end times to pixel indices
-            const std::int64_t start_index{ note_time_to_pixel_index(note.start_ms, note.direction) };
-            if (start_index >= 0 && start_index < visible_led_count)
+            // Between LEDs, the head's light is shared by the two either side of it
+            const std::int64_t head_index{ head_position >> pixel_fraction_bits };
+            const std::uint32_t head_fraction{ static_cast<std::uint32_t>(head_position >> (pixel_fraction_bits - 8)) & 0xff };
+            const packed_color head_color{ Note::get_pixel_color(note.note_color, true) };
+            add_head(head_index, head_color * head_split[head_split.size() - 1 - head_fraction]);
+            if (head_fraction != 0)
             {
-                leds[start_index] += note.get_pixel_color(true);
+                add_head(head_index + 1, head_color * head_split[head_fraction]);
             }
+
+            // Slow notes widen the window, so the head may not have reached the ring yet
+            if (start_index + length_leds < 0)
+            {
+                continue;
+            }
+            const packed_color trail_color{ Note::get_pixel_color(note.note_color, false) };
             switch (note.direction)
             {
                 case Note::Direction::Counterclockwise:
-                {
-                    if (start_index + length_leds < 0)
-                    {
-                        break;
-                    }
-                    const std::int64_t end_index{ std::clamp<std::int64_t>(
-                        start_index - length_leds,
-                        0, visible_led_count
-                    ) };
-                    // fill leds between pixel indices
-                    for (std::size_t index{ static_cast<std::size_t>(end_index) }; index < static_cast<std::size_t>(start_index) && index < visible_led_count; ++index)
-                    {
-                        leds[index] += note.get_pixel_color(false);
-                    }
+                    add_span(start_index - length_leds, start_index, trail_color);
                     break;
-                }
                 case Note::Direction::Clockwise:
-                {
-                    if (start_index + length_leds < 0)
-                    {
-                        break;
-                    }
-                    const std::int64_t end_index{ std::clamp<std::int64_t>(
-                        start_index + length_leds,
-                        0, visible_led_count - 1
-                    ) };
-                    // fill leds between pixel indices
-                    for (std::size_t index{ static_cast<std::size_t>(std::max(start_index + 1ll, 0ll)) }; index <= static_cast<std::size_t>(end_index); ++index)
-                    {
-                        leds[index] += note.get_pixel_color(false);
-                    }
+                    add_span(start_index + 1, std::min<std::int64_t>(start_index + length_leds, visible_led_count - 1) + 1, trail_color);
                     break;
-                }
+            }
+        }
+
+        if (has_spans)
+        {
+            wide_color total{ 0 };
+            for (std::size_t i{ 0 }; i < leds.size(); ++i)
+            {
+                total += spans[i];
+                leds[i] += narrow(total);
             }
         }
         return leds;
     }
 
-    // TODO: Account for note.speed
-    std::int64_t Song::note_length_to_pixel_count(std::uint32_t time_ms) const
+    Song::NotePlacement Song::place_note(const PixelNote& note, std::int64_t current_position)
     {
-        return static_cast<int64_t>(time_ms) / static_cast<int64_t>(header.ms_per_pixel);
+        // The fractions of both positions share a denominator, so at normal speed these match note_length_to_pixel_count
+        // and note_time_to_pixel_index exactly, including rounding toward zero for notes still to come
+        const std::int64_t length{ ((note.end - note.start) * note.speed) >> Note::speed_fraction_bits };
+        const std::int64_t delta{ ((current_position - note.start) * note.speed) >> Note::speed_fraction_bits };
+        const std::int64_t offset{ delta >= 0 ? delta >> pixel_fraction_bits : -(-delta >> pixel_fraction_bits) };
+        const bool counterclockwise{ note.direction == Note::Direction::Counterclockwise };
+        return {
+            .start_index = counterclockwise ? static_cast<std::int64_t>(visible_led_count) + offset : -offset,
+            .length_leds = length >> pixel_fraction_bits,
+            .head_position = counterclockwise ? (static_cast<std::int64_t>(visible_led_count) << pixel_fraction_bits) + delta : -delta,
+            .upcoming = delta < -(static_cast<std::int64_t>(visible_led_count) << pixel_fraction_bits),
+        };
     }
 
-    // TODO: Account for note.speed
-    std::int64_t Song::pixel_count_to_note_length(std::uint32_t count) const
+    std::int64_t Song::note_length_to_pixel_count(std::uint32_t time_ms, std::uint32_t speed /* = Note::speed_one */) const
     {
-        return static_cast<int64_t>(count) * static_cast<int64_t>(header.ms_per_pixel);
+        return static_cast<int64_t>(time_ms) * speed / (static_cast<int64_t>(header.ms_per_pixel) << Note::speed_fraction_bits);
     }
 
-    // TODO: Account for note.speed
-    std::int64_t Song::note_time_to_pixel_index(std::uint32_t time_ms, Note::Direction direction) const
+    std::int64_t Song::pixel_count_to_note_length(std::uint32_t count, std::uint32_t speed /* = Note::speed_one */) const
     {
-        const std::int64_t offset{ (static_cast<std::int64_t>(current_time_ms) - static_cast<std::int64_t>(time_ms)) / static_cast<std::int64_t>(header.ms_per_pixel) };
+        return (static_cast<int64_t>(count) * static_cast<int64_t>(header.ms_per_pixel) << Note::speed_fraction_bits) / speed;
+    }
+
+    std::int64_t Song::note_time_to_pixel_index(std::uint32_t time_ms, Note::Direction direction, std::uint32_t speed /* = Note::speed_one */) const
+    {
+        const std::int64_t offset{
+            (static_cast<std::int64_t>(current_time_ms) - static_cast<std::int64_t>(time_ms)) * speed
+            / (static_cast<std::int64_t>(header.ms_per_pixel) << Note::speed_fraction_bits)
+        };
         if (direction == Note::Direction::Counterclockwise)
         {
             return visible_led_count + offset;
@@ -151,13 +806,21 @@ namespace song_data
         return -offset;
     }
 
-    // TODO: Account for note.speed
-    std::int64_t Song::pixel_index_to_note_time(std::size_t index, Note::Direction direction) const
+    std::int64_t Song::pixel_index_to_note_time(std::size_t index, Note::Direction direction, std::uint32_t speed /* = Note::speed_one */) const
     {
         if (direction == Note::Direction::Counterclockwise)
         {
-            return note_time_to_pixel_index(visible_led_count + index, Note::Direction::Clockwise);
+            return note_time_to_pixel_index(visible_led_count + index, Note::Direction::Clockwise, speed);
         }
-        return static_cast<std::int64_t>(current_time_ms) + static_cast<int64_t>(index) * static_cast<int64_t>(header.ms_per_pixel);
+        return static_cast<std::int64_t>(current_time_ms) + pixel_count_to_note_length(index, speed);
+    }
+
+    // Whole pixels in the high bits, then the remainder as a fraction of ms_per_pixel
+    std::int64_t Song::note_time_to_pixel_position(std::uint32_t time_ms) const
+    {
+        const std::uint32_t whole{ time_ms / header.ms_per_pixel };
+        const std::uint32_t remainder{ time_ms % header.ms_per_pixel };
+        return (static_cast<std::int64_t>(whole) << pixel_fraction_bits)
+            | ((static_cast<std::int64_t>(remainder) << pixel_fraction_bits) / header.ms_per_pixel);
     }
 }
@@ -2,10 +2,12 @@ import os
 import struct
 import sys
 import yaml
+import zlib
 
 TOOL_VERSION = "1.0"
-NOTE_VERSION_MAJOR = 1
-NOTE_VERSION_MINOR = 0
+NOTE_VERSION_MAJOR = 2
+NOTE_VERSION_MINOR = 1
+BLOCK_MS = 1000
 
 def open_yaml(yaml_file):
     with open(yaml_file, "r") as stream:
@@ -22,6 +24,41 @@ def print_usage(script_name):
     print("Generates .note files for the rhythm-machine project from human-readable .yaml files.")
     print("\n\tUsage: python(3)", script_name, "file1.yaml [file2.yaml [...]]\n")
 
+def encode_varint(value):
+    encoded = bytearray()
+    while value >= 0x80:
+        encoded.append((value & 0x7f) | 0x80)
+        value >>= 7
+    encoded.append(value)
+    return encoded
+
+def encode_notes(notes, lead_in_ms):
+    # Returns the block index and the delta coded note data
+    block_index = bytearray()
+    block_count = 0
+    note_data = bytearray()
+    previous_start_ms = 0
+    for index, note in enumerate(notes):
+        start_ms = note["start_ms"] + lead_in_ms
+        while block_count * BLOCK_MS <= start_ms:
+            block_index += struct.pack("<III", index, len(note_data), previous_start_ms)
+            block_count += 1
+        speed = note.get("speed", 1.0)
+        attributes = ["red", "green", "blue"].index(note["color"])
+        attributes |= ["left", "right"].index(note["direction"]) << 2
+        if note["length_ms"] != 0:
+            attributes |= 1 << 3
+        if speed != 1.0:
+            attributes |= 1 << 4
+        note_data.append(attributes)
+        note_data += encode_varint(start_ms - previous_start_ms)
+        if note["length_ms"] != 0:
+            note_data += encode_varint(note["length_ms"])
+        if speed != 1.0:
+            note_data += struct.pack("<f", speed)
+        previous_start_ms = start_ms
+    return block_count, block_index, note_data
+
 def validate_song_data(data):
     def validate_item(data, validator, field_name, print_error = True):
         if isinstance(validator, tuple):
@@ -75,9 +112,16 @@ def validate_song_data(data):
     def positive_integer(x):
         return isinstance(x, int) and x >= 0
 
+    # Optional, so checked apart from ROOT_VALIDATION, which requires every key
+    offset_ms = data.get("song", {}).get("offset_ms", 0) if isinstance(data.get("song"), dict) else 0
+    if not isinstance(offset_ms, int) or offset_ms < -32768 or offset_ms > 32767:
+        print("\tInvalid field: song.offset_ms must be an integer between -32768 and 32767")
+        return False
+
     ROOT_VALIDATION = {
         "song": {
-            "ms_per_pixel": positive_integer,
+            # Positions are kept with 8 bits of fraction, which has to cover a pixel's ms
+            "ms_per_pixel": lambda x: isinstance(x, int) and x >= 1 and x <= 256,
             "lead_in_ms": positive_integer,
             "author": lambda x: isinstance(x, str) and len(x) <= 32,
             "difficulty": lambda x: isinstance(x, int) and x >= 1 and x <= 10
@@ -86,7 +130,8 @@ def validate_song_data(data):
                 "color": ("red", "green", "blue"),
                 "direction": ("left", "right"),
                 "start_ms": positive_integer,
-                "length_ms": positive_integer,
+                # Holds are kept in 16 bits
+                "length_ms": lambda x: positive_integer(x) and x <= 65535,
                 "speed": lambda x: x is None or ((isinstance(x, int) or isinstance(x, float)) and x > 0),
             }, "notes")
     }
@@ -112,25 +157,28 @@ def main(argv):
         if dry_run:
             continue
         print("\tCompiling...")
+        # Long charts are streamed from the SD card, which needs the notes in playing order
+        notes = sorted(data["notes"], key=lambda x: x["start_ms"])
+        block_count, block_index, note_data = encode_notes(notes, data["song"]["lead_in_ms"])
         note_file = open(os.path.splitext(yaml_file)[0] + ".note", "wb")
         note_file.write(struct.pack("4c", *[bytes(x, 'utf-8') for x in "NOTE"]))
         note_file.write(struct.pack("<H", NOTE_VERSION_MAJOR))
         note_file.write(struct.pack("<H", NOTE_VERSION_MINOR))
         note_file.write(struct.pack("<I", data["song"]["ms_per_pixel"]))
-        note_file.write(struct.pack("<I", len(data["notes"])))
+        note_file.write(struct.pack("<I", len(notes)))
         author_fixed = (list(data["song"].get("author", "")) + ['\0'] * 32)[:32]
         note_file.write(struct.pack("32c", *[bytes(c, 'utf-8') for c in author_fixed]))
         note_file.write(struct.pack("<b", data["song"]["difficulty"]))
+        note_file.write(struct.pack("<I", block_count))
+        note_file.write(struct.pack("<I", len(note_data)))
+        note_file.write(struct.pack("<I", zlib.crc32(block_index + note_data)))
+        # Added to every note's start by the player, for charts which are slightly off the music
+        note_file.write(struct.pack("<h", data["song"].get("offset_ms", 0)))
         # padding for future header data
-        note_file.write(struct.pack("31c", *[bytes(c, 'utf-8') for c in ['\0'] * 31]))
-        for note in data["notes"]:
-            note_file.write(struct.pack("<b", ["red", "green", "blue"].index(note["color"])))
-            note_file.write(struct.pack("<b", ["left", "right"].index(note["direction"])))
-            note_file.write(struct.pack("<I", note["start_ms"] + data["song"]["lead_in_ms"]))
-            note_file.write(struct.pack("<I", note["length_ms"]))
-            note_file.write(struct.pack("<f", note.get("speed", 1.0)))
-            # padding for future note data
-            note_file.write(struct.pack("2c", *[bytes(c, 'utf-8') for c in ['\0'] * 2]))
+        note_file.write(struct.pack("17c", *[bytes(c, 'utf-8') for c in ['\0'] * 17]))
+        note_file.write(block_index)
+        note_file.write(note_data)
+        note_file.close()
         print("\tDone!")
     
 if __name__ == "__main__":